@@ -0,0 +1,72 @@
+/*
+ * library interface to the pagerank kernels
+ *
+ * A graph is loaded once, in the same format as the pagerank input, and can then be ranked
+ * any number of times with any of the csr kernels without reading or building it again.
+ * Loading and ranking are not reentrant, so call them from one thread at a time.
+ * Build with `make libpagerank.a` or `make libpagerank.so`.
+ */
+
+#ifndef __LIBPAGERANK_H
+#define __LIBPAGERANK_H
+
+#include <stddef.h>
+
+#define PAGERANK_API __attribute__((visibility("default")))
+
+/* a loaded graph and the scores of its last ranking */
+typedef struct pagerank_graph pagerank_graph;
+
+/* how to rank a graph, zero for the defaults */
+struct pagerank_run_options
+{
+  const char* kernel; /* name of a kernel ranking from the csr e.g. "csr" or "gmres", NULL for "csr" */
+  int ncores;         /* number of threads, 0 for the number in the input */
+  double dampener;    /* dampening effect, 0 for the one in the input */
+};
+
+/* an edge between two pages, by index in input order */
+struct pagerank_edge
+{
+  int source; /* page linking */
+  int target; /* page linked to */
+};
+
+
+/* ========== FUNCTION PROTOTYPES ========== */
+
+/* load a graph from input held in memory, NULL if it is invalid or an allocation fails */
+PAGERANK_API pagerank_graph* pagerank_graph_load_buffer(const char* buffer, size_t size);
+
+/* load a graph from an input file, NULL if it cannot be read, is invalid or an allocation fails */
+PAGERANK_API pagerank_graph* pagerank_graph_load_file(const char* path);
+
+/* free a graph, its scores and the outlinks a ranking kept on it */
+PAGERANK_API void pagerank_graph_destroy(pagerank_graph* graph);
+
+/* copy a graph with edges added and removed, NULL if an edge is invalid or missing or an allocation fails */
+PAGERANK_API pagerank_graph* pagerank_graph_apply(const pagerank_graph* graph, const struct pagerank_edge* added, int nadded,
+    const struct pagerank_edge* removed, int nremoved);
+
+/* rank a graph, replacing the scores of any earlier ranking, 0 on success otherwise -1, not reentrant */
+PAGERANK_API int pagerank_graph_rank(pagerank_graph* graph, const struct pagerank_run_options* options);
+
+/* the number of pages of a graph */
+PAGERANK_API int pagerank_graph_npages(const pagerank_graph* graph);
+
+/* the number of edges of a graph */
+PAGERANK_API int pagerank_graph_nedges(const pagerank_graph* graph);
+
+/* the dampening effect of the input */
+PAGERANK_API double pagerank_graph_dampener(const pagerank_graph* graph);
+
+/* the index of the first page with a name in input order, -1 if there is none */
+PAGERANK_API int pagerank_graph_find(const pagerank_graph* graph, const char* name);
+
+/* the name of the page at an index in input order, NULL if there is no such page */
+PAGERANK_API const char* pagerank_graph_name(const pagerank_graph* graph, int index);
+
+/* the scores of the last ranking in input order, NULL if the graph has not been ranked */
+PAGERANK_API const double* pagerank_graph_scores(const pagerank_graph* graph);
+
+#endif
@@ -1,15 +1,123 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <malloc.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <omp.h>
 
 #include "pagerank.h"
+#include "libpagerank.h"
 
 #define END_ITER (5E-3 * 5E-3)
 
 
+/* subsystems the memory accounting splits the tracked bytes between */
+#define MEMORY_PAGES 0		// page structs, the page list and per page csr arrays
+#define MEMORY_EDGES 1		// inlink lists, csr edge arrays and the edge layouts kernels build
+#define MEMORY_NAMES 2		// string tables and name hash tables
+#define MEMORY_SCORES 3		// score vectors
+#define MEMORY_SCRATCH 4	// kernel working space
+#define MEMORY_KINDS 5
+
+static const char* memory_kind_names[MEMORY_KINDS] = { "pages", "edges", "names", "scores", "scratch" };
+
+/* bytes held and most ever held by each subsystem, and by all of them together */
+static atomic_long memory_current[MEMORY_KINDS + 1];
+static atomic_long memory_peak[MEMORY_KINDS + 1];
+
+
+/**
+ * Raise a peak to at least a value
+ */
+static void memory_raise(atomic_long* peak, long value) {
+	long seen = atomic_load(peak);
+	while (value > seen && !atomic_compare_exchange_weak(peak, &seen, value)) {
+	}
+}
+
+
+/**
+ * Count bytes allocated (or freed when negative) against a subsystem
+ * @param kind, the MEMORY_ subsystem
+ * @param bytes, the change in bytes held
+ */
+static void memory_add(int kind, long bytes) {
+	memory_raise(&memory_peak[kind], atomic_fetch_add(&memory_current[kind], bytes) + bytes);
+	memory_raise(&memory_peak[MEMORY_KINDS], atomic_fetch_add(&memory_current[MEMORY_KINDS], bytes) + bytes);
+}
+
+
+/**
+ * malloc counted against a subsystem, by the usable size so frees take back exactly what was added
+ */
+static void* memory_malloc(int kind, size_t size) {
+	void* block = malloc(size);
+	if (block != NULL) {
+		memory_add(kind, (long)malloc_usable_size(block));
+	}
+	return block;
+}
+
+
+/**
+ * calloc counted against a subsystem
+ */
+static void* memory_calloc(int kind, size_t count, size_t size) {
+	void* block = calloc(count, size);
+	if (block != NULL) {
+		memory_add(kind, (long)malloc_usable_size(block));
+	}
+	return block;
+}
+
+
+/**
+ * aligned_alloc counted against a subsystem
+ */
+static void* memory_aligned_alloc(int kind, size_t alignment, size_t size) {
+	void* block = aligned_alloc(alignment, size);
+	if (block != NULL) {
+		memory_add(kind, (long)malloc_usable_size(block));
+	}
+	return block;
+}
+
+
+/**
+ * realloc of a block counted against a subsystem, which stays counted unchanged if this fails
+ */
+static void* memory_realloc(int kind, void* block, size_t size) {
+	long before = block != NULL ? (long)malloc_usable_size(block) : 0;
+	void* grown = realloc(block, size);
+	if (grown != NULL) {
+		memory_add(kind, (long)malloc_usable_size(grown) - before);
+	}
+	return grown;
+}
+
+
+/**
+ * free a block counted against a subsystem
+ */
+static void memory_free(int kind, void* block) {
+	if (block != NULL) {
+		memory_add(kind, -(long)malloc_usable_size(block));
+		free(block);
+	}
+}
+
+
 /**
  * The struct to store the page and its score
  */
@@ -29,7 +137,95 @@ void clean_up(void* page_scores) {
 	if (page_scores == NULL) {
 		return;
 	}
-	free(page_scores);
+	memory_free(MEMORY_SCORES, page_scores);
+}
+
+
+/* sum the residual over fixed blocks of pages in a fixed order, picked with -D */
+static int deterministic_sums = 0;
+
+/* pages summed in order into each partial sum of a deterministic residual */
+#define SUM_BLOCK 1024
+
+
+/**
+ * Sum values pairwise in a tree whose shape only depends on the count
+ * @param values, the values to sum
+ * @param count, the number of values
+ * @return the sum
+ */
+double pairwise_sum(const double* values, int count) {
+	if (count <= 8) {
+		double total = 0.0;
+		for (int i = 0; i < count; i++) {
+			total += values[i];
+		}
+		return total;
+	}
+	int half = count / 2;
+	return pairwise_sum(values, half) + pairwise_sum(values + half, count - half);
+}
+
+
+/* stop ranking after this many seconds even if not converged, picked with -t, 0 for no deadline */
+static double budget_seconds = 0;
+
+/* stop ranking once the scores are within this L1 distance of the limit instead of at EPSILON, picked with -E */
+static double budget_error = 0;
+
+
+/**
+ * Progress of a ranking against its time and error budget
+ */
+struct budget {
+	double deadline;	// wall clock time to stop at, 0 for none
+	int iterations;
+	int expired;		// stopped at the deadline before converging
+	double residual;	// L2 change of the last iteration, what EPSILON is compared with
+	double bound;		// most the scores can be from the limit in L1
+};
+
+
+/**
+ * Start the budget of a ranking
+ */
+static void budget_start(struct budget* budget) {
+	memset(budget, 0, sizeof(struct budget));
+	budget->deadline = budget_seconds > 0 ? omp_get_wtime() + budget_seconds : 0;
+}
+
+
+/**
+ * Record an iteration against the budget and decide whether to stop
+ * Each iteration multiplies the distance from the limit by dM, whose columns sum to at most the
+ * dampening effect d, so in L1 the scores are at most d / (1 - d) times the last change away.
+ * Scores summing to at most one are never more than 2 away, which bounds it near d = 1.
+ * @param budget, the budget
+ * @param dampener, the dampening effect on the pages
+ * @param residual, the L2 change of the iteration
+ * @param change, the L1 change of the iteration
+ * @return whether to stop
+ */
+static int budget_done(struct budget* budget, double dampener, double residual, double change) {
+	budget->iterations++;
+	budget->residual = residual;
+	budget->bound = fmin(dampener / (1.0 - dampener) * change, 2.0);
+	if (budget_error > 0 ? budget->bound <= budget_error : residual <= EPSILON) {
+		return 1;
+	}
+	budget->expired = budget->deadline > 0 && omp_get_wtime() >= budget->deadline;
+	return budget->expired;
+}
+
+
+/**
+ * Print how a ranking with a budget (-t or -E) finished on stderr, and nothing without one
+ */
+static void budget_report(const struct budget* budget) {
+	if (budget_seconds > 0 || budget_error > 0) {
+		fprintf(stderr, "iterations %d residual %g bound %g%s\n", budget->iterations, budget->residual, budget->bound,
+				budget->expired ? " deadline" : "");
+	}
 }
 
 
@@ -40,7 +236,7 @@ void clean_up(void* page_scores) {
  * @return the array of page score structs
  */
 struct page_score* init_pageranks(list* plist, int npages) {
-	struct page_score* page_scores = malloc(sizeof(struct page_score) * npages);
+	struct page_score* page_scores = memory_malloc(MEMORY_SCORES, sizeof(struct page_score) * npages);
 	register double initial_value = 1/(double)(npages);
 	node* current = plist->head;
 	for (size_t i = 0; i < npages; i++) {
@@ -290,7 +486,7 @@ struct page_score_2D {
 * @return the array of page score structs
 */
 struct page_score_2D* init_pageranks_2D(list* plist, int npages) {
-  struct page_score_2D* page_scores = malloc(sizeof(struct page_score_2D) * npages);
+  struct page_score_2D* page_scores = memory_malloc(MEMORY_SCORES, sizeof(struct page_score_2D) * npages);
   register double initial_value = 1/(double)(npages);
   node* current = plist->head;
   for (size_t i = 0; i < npages; i++) {
@@ -379,7 +575,7 @@ struct page_score_padding {
  * @return the array of page score structs
  */
 struct page_score_padding* init_pageranks_padding(list* plist, int npages) {
-	struct page_score_padding* page_scores = malloc(sizeof(struct page_score_padding) * npages);
+	struct page_score_padding* page_scores = memory_malloc(MEMORY_SCORES, sizeof(struct page_score_padding) * npages);
 	register double initial_value = 1/(double)(npages);
 	node* current = plist->head;
 	for (size_t i = 0; i < npages; i++) {
@@ -415,6 +611,14 @@ void pagerank_padding(list* plist, int ncores, int npages, int nedges, double da
 	int old_index = 15;
 	int new_index = 0;
 
+	// Partial residual of each block of pages for deterministic sums
+	int nblocks = (npages + SUM_BLOCK - 1) / SUM_BLOCK;
+	double* block_sums = deterministic_sums ? memory_malloc(MEMORY_SCRATCH, sizeof(double) * nblocks) : NULL;
+	if (page_scores == NULL || (deterministic_sums && block_sums == NULL)) {
+		clean_up(page_scores);
+		return;
+	}
+
 	// Loop through until the convergence threshold is reached
 
 	while (diff > END_ITER) {
@@ -447,9 +651,24 @@ void pagerank_padding(list* plist, int ncores, int npages, int nedges, double da
 			
 		}
 
-		#pragma omp parallel for reduction (+:diff)
-		for (i = 0; i < npages; i++) {
-			diff += (page_scores[i].score[new_index] - page_scores[i].score[old_index]) * (page_scores[i].score[new_index] - page_scores[i].score[old_index]);
+		if (deterministic_sums) {
+			// Same blocks summed in the same order whatever the number of threads
+			#pragma omp parallel for schedule(static)
+			for (int b = 0; b < nblocks; b++) {
+				int end = (b + 1) * SUM_BLOCK < npages ? (b + 1) * SUM_BLOCK : npages;
+				double total = 0.0;
+				for (int k = b * SUM_BLOCK; k < end; k++) {
+					double change = page_scores[k].score[new_index] - page_scores[k].score[old_index];
+					total += change * change;
+				}
+				block_sums[b] = total;
+			}
+			diff = pairwise_sum(block_sums, nblocks);
+		} else {
+			#pragma omp parallel for reduction (+:diff)
+			for (i = 0; i < npages; i++) {
+				diff += (page_scores[i].score[new_index] - page_scores[i].score[old_index]) * (page_scores[i].score[new_index] - page_scores[i].score[old_index]);
+			}
 		}
 
 		old_index ^= new_index;
@@ -463,6 +682,7 @@ void pagerank_padding(list* plist, int ncores, int npages, int nedges, double da
 		// printf("%s %.4lf\n", page_scores[i].page->name, page_scores[i].score[!x]);
 	}
 
+	memory_free(MEMORY_SCRATCH, block_sums);
 	clean_up(page_scores);
 }
 
@@ -505,9 +725,15 @@ void pagerank_mm(list* plist, int ncores, int npages, int nedges, double dampene
 		return;
 	}
 
-	double* score_vector = malloc(sizeof(double) * npages);
-	double* rank_vector = malloc(sizeof(double) * npages);
-	double* matrix = calloc(sizeof(double), npages * npages);
+	double* score_vector = memory_malloc(MEMORY_SCORES, sizeof(double) * npages);
+	double* rank_vector = memory_malloc(MEMORY_SCORES, sizeof(double) * npages);
+	double* matrix = memory_calloc(MEMORY_SCRATCH, sizeof(double), (size_t)npages * npages);
+	if (score_vector == NULL || rank_vector == NULL || matrix == NULL) {
+		memory_free(MEMORY_SCORES, score_vector);
+		memory_free(MEMORY_SCORES, rank_vector);
+		memory_free(MEMORY_SCRATCH, matrix);
+		return;
+	}
 	double dampening_value = (1.0 - dampener)/((double)(npages));
 	double diff = 1; // Used to check the difference of the scores
 	node* current = plist->head;
@@ -516,7 +742,7 @@ void pagerank_mm(list* plist, int ncores, int npages, int nedges, double dampene
 		if (current->page->inlinks) {
 			node* node = current->page->inlinks->head;
 			while (node) {
-				matrix[i * npages + node->page->index] = dampener/((double)node->page->noutlinks);
+				matrix[(size_t)i * npages + node->page->index] = dampener/((double)node->page->noutlinks);
 				node = node->next;
 			}
 		}
@@ -530,14 +756,14 @@ void pagerank_mm(list* plist, int ncores, int npages, int nedges, double dampene
 
 		double sum = 0;
 		for (int i = 0; i < npages; i++) {
-			if (matrix[(i * npages) + j]) {
+			if (matrix[((size_t)i * npages) + j]) {
 				sum = 1;
 				break;
 			}
 		}
 		if (!sum) {
 			for (int i = 0; i < npages; i++) {
-				matrix[i * npages + j] = dampener/((double)npages);
+				matrix[(size_t)i * npages + j] = dampener/((double)npages);
 			}
 		}
 	}
@@ -588,16 +814,91 @@ void pagerank_mm(list* plist, int ncores, int npages, int nedges, double dampene
 		 current = current->next;
 	}
 
-	free(score_vector);
-	free(rank_vector);
-	free(matrix);
+	memory_free(MEMORY_SCORES, score_vector);
+	memory_free(MEMORY_SCORES, rank_vector);
+	memory_free(MEMORY_SCRATCH, matrix);
+}
+
+
+
+/* pin each OpenMP thread to its own cpu, picked with -p */
+static int pin_threads = 0;
+
+
+/**
+ * Pin the threads of the OpenMP team to cpus spread evenly over the cpus this process may
+ * run on, so a team smaller than the machine still covers every socket and each thread keeps
+ * the pages it first touched on its own node
+ * @param ncores, number of threads in the team
+ */
+void pin_team(int ncores) {
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0) {
+		return;
+	}
+	int ncpus = CPU_COUNT(&allowed);
+
+	#pragma omp parallel num_threads(ncores)
+	{
+		int thread = omp_get_thread_num();
+		int target = (int)((long)thread * ncpus / omp_get_num_threads());
+
+		// Find the target'th allowed cpu
+		for (int cpu = 0, seen = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed) && seen++ == target) {
+				cpu_set_t mask;
+				CPU_ZERO(&mask);
+				CPU_SET(cpu, &mask);
+				sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+				break;
+			}
+		}
+	}
 }
 
 
+/**
+ * Initialise the struct array of page scores in parallel with the static schedule the kernel
+ * uses, so every page score is first touched (and placed in memory) by the thread that owns it
+ * @param plist, the list of pages
+ * @param npages, the number of pages
+ * @return the cache line aligned array of page score structs, or NULL if malloc fails
+ */
+struct page_score* init_pageranks_first_touch(list* plist, int npages) {
+	struct page_score* page_scores = memory_aligned_alloc(MEMORY_SCORES, 64, sizeof(struct page_score) * npages);
+	page** pages = memory_malloc(MEMORY_SCRATCH, sizeof(page*) * npages);
+	if (page_scores == NULL || pages == NULL) {
+		memory_free(MEMORY_SCORES, page_scores);
+		memory_free(MEMORY_SCRATCH, pages);
+		return NULL;
+	}
+
+	// Walk the list on the master thread without touching the page scores
+	node* current = plist->head;
+	for (int i = 0; i < npages; i++) {
+		pages[i] = current->page;
+		current = current->next;
+	}
+
+	double initial_value = 1/(double)(npages);
+	#pragma omp parallel for schedule(static)
+	for (int i = 0; i < npages; i++) {
+		page_scores[i].page = pages[i];
+		page_scores[i].score[0] = initial_value;
+		page_scores[i].score[1] = initial_value;
+		page_scores[i].difference = 0;
+	}
+
+	memory_free(MEMORY_SCRATCH, pages);
+	return page_scores;
+}
+
 
 /**
  * PageRank algorithm OpenMP
  * Given a list of pages calculate the ranking of the pages using a dampening effect
+ * Each thread owns the same static range of pages for initialisation, the sweep and the
+ * reduction, so on NUMA machines it only reads its own pages' scores from local memory.
  * @param plist, list of pages
  * @param ncores, number of cores
  * @param npages, number of pages
@@ -610,20 +911,39 @@ void pagerank(list* plist, int ncores, int npages, int nedges, double dampener)
 		return;
 	}
 
+	omp_set_num_threads(ncores);
+	if (pin_threads) {
+		pin_team(ncores);
+	}
+
 	// Create page scores vector and load register for reused values
-	struct page_score* page_scores = init_pageranks(plist, npages);
+	struct page_score* page_scores = init_pageranks_first_touch(plist, npages);
+	if (page_scores == NULL) {
+		return;
+	}
 	double dampening_value = (1.0 - dampener)/((double)(npages));
 	register int x = 1;
-	omp_set_num_threads(ncores);
+
+	// Partial residual then partial change of each block of pages for deterministic sums
+	int nblocks = (npages + SUM_BLOCK - 1) / SUM_BLOCK;
+	double* block_sums = deterministic_sums ? memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * nblocks) : NULL;
+	if (deterministic_sums && block_sums == NULL) {
+		clean_up(page_scores);
+		return;
+	}
 
 	register double diff = 1; // Used to check the difference of the scores
+	double change;		// L1 difference of the scores
+	struct budget budget;
+	budget_start(&budget);
 
-	// Loop through until the convergence threshold is reached
-	while (diff > 0.000025) {
+	// Loop through until the convergence threshold is reached or the budget runs out
+	for (int done = 0; !done;) {
 		diff = 0.0;
+		change = 0.0;
 		size_t i;
 
-		#pragma omp parallel for private(i)
+		#pragma omp parallel for schedule(static) private(i)
 		for (i = 0; i < npages; i++) {
 			page_scores[i].score[x] = dampening_value;
 			double total = 0.0;
@@ -648,51 +968,6088 @@ void pagerank(list* plist, int ncores, int npages, int nedges, double dampener)
 			page_scores[i].difference = (page_scores[i].score[x] - page_scores[i].score[!x]) * (page_scores[i].score[x] - page_scores[i].score[!x]);
 		}
 
-		#pragma omp parallel for reduction (+:diff)
-		for (i = 0; i < npages; i++) {
-			diff += page_scores[i].difference;
+		if (deterministic_sums) {
+			// Same blocks summed in the same order whatever the number of threads
+			#pragma omp parallel for schedule(static)
+			for (int b = 0; b < nblocks; b++) {
+				int end = (b + 1) * SUM_BLOCK < npages ? (b + 1) * SUM_BLOCK : npages;
+				double total = 0.0;
+				double distance = 0.0;
+				for (int k = b * SUM_BLOCK; k < end; k++) {
+					total += page_scores[k].difference;
+					distance += sqrt(page_scores[k].difference);
+				}
+				block_sums[b] = total;
+				block_sums[nblocks + b] = distance;
+			}
+			diff = pairwise_sum(block_sums, nblocks);
+			change = pairwise_sum(block_sums + nblocks, nblocks);
+		} else {
+			#pragma omp parallel for schedule(static) reduction (+:diff, change)
+			for (i = 0; i < npages; i++) {
+				diff += page_scores[i].difference;
+				change += sqrt(page_scores[i].difference);
+			}
 		}
 
 		x = (x + 1) % 2;	// Update the value so we do not have to copy
+		done = budget_done(&budget, dampener, sqrt(diff), change);
 	}
+	budget_report(&budget);
 	
 	// Print the results to stdout
 	for (int i = 0; i < npages; i++) {
 		// printf("%s %.4lf\n", page_scores[i].page->name, page_scores[i].score[!x]);
 	}
 
+	memory_free(MEMORY_SCRATCH, block_sums);
 	clean_up(page_scores);
 }
 
 
-/*
-######################################
-### DO NOT MODIFY BELOW THIS POINT ###
-######################################
-*/
+/* longest page name read with -n, otherwise names are cut off at NAME_SIZE - 1 like read_input */
+#define LONG_NAME_SIZE BUFFER_SIZE
 
-int main(void) {
+/* accept page names longer than NAME_SIZE - 1 with the parallel loader, picked with -n */
+static int long_names = 0;
 
-    /*
-    ######################################################
-    ### DO NOT MODIFY THE MAIN FUNCTION OR HEADER FILE ###
-    ######################################################
-    */
+/* longest line the parallel loaders read, an edge line of two long names with -n, otherwise BUFFER_SIZE like read_input */
+#define LONG_LINE_SIZE (2 * LONG_NAME_SIZE + 1)
+#define LINE_SIZE (long_names ? LONG_LINE_SIZE : BUFFER_SIZE)
 
-    list* plist = NULL;
 
-    double dampener;
-    int ncores, npages, nedges;
+/**
+ * The page names packed one after another into a single arena in input order
+ * Kernels only keep page indices, so printing streams the names from here instead of chasing
+ * every page struct, and names are not limited to the size of page.name.
+ */
+struct string_table {
+	int count;
+	int capacity;		// offsets allocated
+	size_t size;		// bytes used
+	size_t bytes_capacity;
+	size_t* offsets;	// name i starts at bytes[offsets[i]]
+	char* bytes;
+};
 
-    /* read the input then populate settings and the list of pages */
-    read_input(&plist, &ncores, &npages, &nedges, &dampener);
+
+/**
+ * Create an empty string table
+ * @param capacity, the number of names to make room for
+ * @return the table, or NULL if an allocation fails
+ */
+struct string_table* string_table_create(int capacity) {
+	struct string_table* table = memory_calloc(MEMORY_NAMES, 1, sizeof(struct string_table));
+	if (table == NULL) {
+		return NULL;
+	}
+	table->capacity = capacity > 0 ? capacity : 1;
+	table->bytes_capacity = (size_t)table->capacity * 8;
+	table->offsets = memory_malloc(MEMORY_NAMES, sizeof(size_t) * table->capacity);
+	table->bytes = memory_malloc(MEMORY_NAMES, table->bytes_capacity);
+	if (table->offsets == NULL || table->bytes == NULL) {
+		memory_free(MEMORY_NAMES, table->offsets);
+		memory_free(MEMORY_NAMES, table->bytes);
+		memory_free(MEMORY_NAMES, table);
+		return NULL;
+	}
+	return table;
+}
+
+
+/**
+ * Clean up an allocated string table
+ */
+void string_table_destroy(struct string_table* table) {
+	if (table == NULL) {
+		return;
+	}
+	memory_free(MEMORY_NAMES, table->offsets);
+	memory_free(MEMORY_NAMES, table->bytes);
+	memory_free(MEMORY_NAMES, table);
+}
+
+
+/**
+ * Append a name to a string table
+ * @param table, the table
+ * @param name, the name to copy in
+ * @return the index of the name, or -1 if an allocation fails
+ */
+int string_table_add(struct string_table* table, const char* name) {
+	size_t length = strlen(name) + 1;
+	if (table->count == table->capacity) {
+		size_t* offsets = memory_realloc(MEMORY_NAMES, table->offsets, sizeof(size_t) * table->capacity * 2);
+		if (offsets == NULL) {
+			return -1;
+		}
+		table->offsets = offsets;
+		table->capacity *= 2;
+	}
+	if (table->size + length > table->bytes_capacity) {
+		size_t bytes_capacity = table->bytes_capacity * 2 + length;
+		char* bytes = memory_realloc(MEMORY_NAMES, table->bytes, bytes_capacity);
+		if (bytes == NULL) {
+			return -1;
+		}
+		table->bytes = bytes;
+		table->bytes_capacity = bytes_capacity;
+	}
+	memcpy(table->bytes + table->size, name, length);
+	table->offsets[table->count] = table->size;
+	table->size += length;
+	return table->count++;
+}
+
+
+/**
+ * Get a name from a string table
+ * @param table, the table
+ * @param index, the index string_table_add returned for the name
+ * @return the name
+ */
+static inline const char* string_table_get(const struct string_table* table, int index) {
+	return table->bytes + table->offsets[index];
+}
+
+
+/**
+ * Compressed sparse row view of the inlinks of every page
+ */
+struct csr {
+	int npages;
+	int nedges;
+	int* offsets;		// inlinks of page i are sources[offsets[i]] .. sources[offsets[i + 1] - 1]
+	int* sources;		// index of the page at the other end of each inlink
+	int* weights;		// times each inlink appears in the input after csr_coalesce, otherwise NULL for once
+	double* inv_outlinks;	// 1 / noutlinks for each page, 0 when the page has no outlinks
+	page** pages;		// page of each index in index order, NULL for graphs made by pagerank_graph_apply
+	int* out_offsets;	// outlinks of page i are targets[out_offsets[i]] .. targets[out_offsets[i + 1] - 1]
+	int* targets;		// index of the page at the other end of each outlink, NULL until built
+	int* positions;		// index of each page in input order after csr_reorder, otherwise NULL
+	struct string_table* names;	// page names in input order
+	int ranked_once;	// destroyed after one ranking, so a kernel may free the inlinks once it has replaced them
+};
+
+
+/**
+ * Clean up an allocated csr
+ * @param graph, the csr to free
+ */
+void csr_destroy(struct csr* graph) {
+	if (graph == NULL) {
+		return;
+	}
+	memory_free(MEMORY_PAGES, graph->offsets);
+	memory_free(MEMORY_EDGES, graph->sources);
+	memory_free(MEMORY_EDGES, graph->weights);
+	memory_free(MEMORY_PAGES, graph->inv_outlinks);
+	memory_free(MEMORY_PAGES, graph->pages);
+	string_table_destroy(graph->names);
+	memory_free(MEMORY_PAGES, graph->out_offsets);
+	memory_free(MEMORY_EDGES, graph->targets);
+	memory_free(MEMORY_PAGES, graph->positions);
+	memory_free(MEMORY_PAGES, graph);
+}
+
+
+/**
+ * Flatten the inlink lists of the pages into a csr so kernels can stream the edges
+ * @param plist, the list of pages
+ * @param npages, the number of pages
+ * @param nedges, the number of edges
+ * @return the csr, or NULL if an allocation fails
+ */
+struct csr* csr_create(list* plist, int npages, int nedges) {
+	struct csr* graph = memory_calloc(MEMORY_PAGES, 1, sizeof(struct csr));
+	if (graph == NULL) {
+		return NULL;
+	}
+	graph->npages = npages;
+	graph->nedges = nedges;
+	graph->offsets = memory_malloc(MEMORY_PAGES, sizeof(int) * (npages + 1));
+	graph->sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1));
+	graph->inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * npages);
+	graph->pages = memory_malloc(MEMORY_PAGES, sizeof(page*) * npages);
+	graph->names = string_table_create(npages);
+	if (graph->offsets == NULL || graph->sources == NULL || graph->inv_outlinks == NULL || graph->pages == NULL
+			|| graph->names == NULL) {
+		csr_destroy(graph);
+		return NULL;
+	}
+
+	int edge = 0;
+	node* current = plist->head;
+	for (int i = 0; i < npages; i++) {
+		page* p = current->page;
+		graph->pages[i] = p;
+		if (string_table_add(graph->names, p->name) < 0) {
+			csr_destroy(graph);
+			return NULL;
+		}
+		graph->offsets[i] = edge;
+		graph->inv_outlinks[i] = p->noutlinks > 0 ? 1.0 / (double)p->noutlinks : 0.0;
+
+		// Keep the order of the inlink list so sums match the list kernels
+		if (p->inlinks != NULL) {
+			for (node* link = p->inlinks->head; link != NULL; link = link->next) {
+				graph->sources[edge++] = link->page->index;
+			}
+		}
+		current = current->next;
+	}
+	graph->offsets[npages] = edge;
+	return graph;
+}
+
+
+
+/**
+ * Build the outlink (transposed) side of a csr from its inlinks
+ * @param graph, the csr to add the outlinks to
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+int csr_build_outlinks(struct csr* graph) {
+	if (graph->targets != NULL) {
+		return 0;
+	}
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	graph->out_offsets = memory_calloc(MEMORY_PAGES, npages + 1, sizeof(int));
+	graph->targets = memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1));
+	int* fill = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	if (graph->out_offsets == NULL || graph->targets == NULL || fill == NULL) {
+		memory_free(MEMORY_PAGES, graph->out_offsets);
+		memory_free(MEMORY_EDGES, graph->targets);
+		memory_free(MEMORY_SCRATCH, fill);
+		graph->out_offsets = NULL;
+		graph->targets = NULL;
+		return -1;
+	}
+
+	// Count the outlinks of each page then prefix sum into offsets
+	for (int e = 0; e < nedges; e++) {
+		graph->out_offsets[graph->sources[e] + 1]++;
+	}
+	for (int i = 0; i < npages; i++) {
+		graph->out_offsets[i + 1] += graph->out_offsets[i];
+		fill[i] = graph->out_offsets[i];
+	}
+
+	// Scatter each inlink into the outlinks of its source
+	for (int i = 0; i < npages; i++) {
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			graph->targets[fill[graph->sources[e]]++] = i;
+		}
+	}
+	memory_free(MEMORY_SCRATCH, fill);
+	return 0;
+}
+
+#define COALESCE_NONE 0
+#define COALESCE_KEEP_LOOPS 1
+#define COALESCE_DROP_LOOPS 2
+
+/* how csr kernels merge repeated edges into weighted ones, picked with -u or the weighted kernel */
+static int coalesce_edges = COALESCE_NONE;
+
+
+/**
+ * Merge the repeated inlinks of every page of a csr into one inlink weighted by its count
+ * The first occurrence of each source keeps its place so the inlinks stay in input order. The
+ * outlinks of every page are counted again from the weights, so dropping a self loop takes it
+ * out of its page's outlinks too. Any outlinks built earlier are freed to be rebuilt.
+ * @param graph, the csr
+ * @param drop_loops, whether to drop the inlinks of pages from themselves
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+int csr_coalesce(struct csr* graph, int drop_loops) {
+	if (graph->weights != NULL) {
+		return 0;
+	}
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	int* weights = memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1));
+	int* kept_at = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);	// where each source was last kept
+	int* out_weights = memory_calloc(MEMORY_SCRATCH, npages, sizeof(int));
+	if (weights == NULL || kept_at == NULL || out_weights == NULL) {
+		memory_free(MEMORY_EDGES, weights);
+		memory_free(MEMORY_SCRATCH, kept_at);
+		memory_free(MEMORY_SCRATCH, out_weights);
+		return -1;
+	}
+	for (int i = 0; i < npages; i++) {
+		kept_at[i] = -1;
+	}
+
+	// Compact in place, each page's kept inlinks start at or before its old ones
+	int kept = 0;
+	int loops = 0;
+	for (int i = 0; i < npages; i++) {
+		int start = kept;
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int src = graph->sources[e];
+			if (src == i && drop_loops) {
+				loops++;
+			} else if (kept_at[src] >= start) {
+				weights[kept_at[src]]++;
+			} else {
+				kept_at[src] = kept;
+				graph->sources[kept] = src;
+				weights[kept++] = 1;
+			}
+		}
+		graph->offsets[i] = start;
+	}
+	graph->offsets[npages] = kept;
+	graph->nedges = kept;
+
+	for (int e = 0; e < kept; e++) {
+		out_weights[graph->sources[e]] += weights[e];
+	}
+	for (int i = 0; i < npages; i++) {
+		graph->inv_outlinks[i] = out_weights[i] > 0 ? 1.0 / (double)out_weights[i] : 0.0;
+	}
+	memory_free(MEMORY_SCRATCH, kept_at);
+	memory_free(MEMORY_SCRATCH, out_weights);
+
+	// Give back what the merged inlinks no longer need
+	int* sources = memory_realloc(MEMORY_EDGES, graph->sources, sizeof(int) * (kept > 0 ? kept : 1));
+	if (sources != NULL) {
+		graph->sources = sources;
+	}
+	int* shrunk = memory_realloc(MEMORY_EDGES, weights, sizeof(int) * (kept > 0 ? kept : 1));
+	graph->weights = shrunk != NULL ? shrunk : weights;
+	memory_free(MEMORY_PAGES, graph->out_offsets);
+	memory_free(MEMORY_EDGES, graph->targets);
+	graph->out_offsets = NULL;
+	graph->targets = NULL;
+	fprintf(stderr, "coalesced %d inlinks into %d, dropped %d self loops\n", nedges, kept, loops);
+	return 0;
+}
+
+
+#define REORDER_NONE 0
+#define REORDER_DEGREE 1
+#define REORDER_RCM 2
+#define REORDER_GORDER 3
+
+#define GORDER_WINDOW 5
+
+/* how csr kernels relabel the pages before ranking, picked with -r */
+static int reorder_method = REORDER_NONE;
+
+/* csr built by read_input_parallel, taken over by the first csr_prepare */
+static struct csr* loaded_graph = NULL;
+
+/* whether the input is parsed as it is read and the scores formatted in parallel, picked with -P */
+static int pipeline_input = 0;
+
+
+/**
+ * Order the pages by number of outlinks, most first, so the sources read most often by a
+ * pull share cache lines
+ * @param graph, the csr
+ * @param order, filled with the old index of the page to put at each new index
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int order_degree(struct csr* graph, int* order) {
+	int npages = graph->npages;
+	int max_degree = 0;
+	for (int i = 0; i < npages; i++) {
+		if (graph->pages[i]->noutlinks > max_degree) {
+			max_degree = graph->pages[i]->noutlinks;
+		}
+	}
+
+	// Stable counting sort from the highest degree down
+	int* starts = memory_calloc(MEMORY_SCRATCH, max_degree + 2, sizeof(int));
+	if (starts == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < npages; i++) {
+		starts[max_degree - graph->pages[i]->noutlinks + 1]++;
+	}
+	for (int d = 0; d <= max_degree; d++) {
+		starts[d + 1] += starts[d];
+	}
+	for (int i = 0; i < npages; i++) {
+		order[starts[max_degree - graph->pages[i]->noutlinks]++] = i;
+	}
+	memory_free(MEMORY_SCRATCH, starts);
+	return 0;
+}
+
+
+/**
+ * Compare packed (degree << 32 | page) keys for qsort
+ */
+static int compare_keys(const void* a, const void* b) {
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Order the pages by reverse Cuthill-McKee over the links in both directions, so linked pages
+ * end up with nearby indices
+ * @param graph, the csr with outlinks built
+ * @param order, filled with the old index of the page to put at each new index
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int order_rcm(struct csr* graph, int* order) {
+	int npages = graph->npages;
+	char* visited = memory_calloc(MEMORY_SCRATCH, npages, sizeof(char));
+	long long* keys = memory_malloc(MEMORY_SCRATCH, sizeof(long long) * npages);
+	long long* neighbours = memory_malloc(MEMORY_SCRATCH, sizeof(long long) * ((size_t)graph->offsets[npages] * 2 + 1));
+	if (visited == NULL || keys == NULL || neighbours == NULL) {
+		memory_free(MEMORY_SCRATCH, visited);
+		memory_free(MEMORY_SCRATCH, keys);
+		memory_free(MEMORY_SCRATCH, neighbours);
+		return -1;
+	}
+
+	// Start each component from its unvisited page of lowest degree
+	for (int i = 0; i < npages; i++) {
+		int degree = (graph->offsets[i + 1] - graph->offsets[i]) + (graph->out_offsets[i + 1] - graph->out_offsets[i]);
+		keys[i] = ((long long)degree << 32) | i;
+	}
+	qsort(keys, npages, sizeof(long long), compare_keys);
+
+	int head = 0;
+	int tail = 0;
+	for (int s = 0; s < npages; s++) {
+		int start = (int)(keys[s] & 0xFFFFFFFF);
+		if (visited[start]) {
+			continue;
+		}
+		visited[start] = 1;
+		order[tail++] = start;
+
+		// Breadth first, visiting the neighbours of each page from lowest degree
+		while (head < tail) {
+			int v = order[head++];
+			int count = 0;
+			for (int e = graph->offsets[v]; e < graph->offsets[v + 1]; e++) {
+				int w = graph->sources[e];
+				if (!visited[w]) {
+					visited[w] = 1;
+					neighbours[count++] = ((long long)(graph->offsets[w + 1] - graph->offsets[w]
+						+ graph->out_offsets[w + 1] - graph->out_offsets[w]) << 32) | w;
+				}
+			}
+			for (int e = graph->out_offsets[v]; e < graph->out_offsets[v + 1]; e++) {
+				int w = graph->targets[e];
+				if (!visited[w]) {
+					visited[w] = 1;
+					neighbours[count++] = ((long long)(graph->offsets[w + 1] - graph->offsets[w]
+						+ graph->out_offsets[w + 1] - graph->out_offsets[w]) << 32) | w;
+				}
+			}
+			qsort(neighbours, count, sizeof(long long), compare_keys);
+			for (int n = 0; n < count; n++) {
+				order[tail++] = (int)(neighbours[n] & 0xFFFFFFFF);
+			}
+		}
+	}
+
+	// Reverse
+	for (int i = 0; i < npages / 2; i++) {
+		int temp = order[i];
+		order[i] = order[npages - 1 - i];
+		order[npages - 1 - i] = temp;
+	}
+
+	memory_free(MEMORY_SCRATCH, visited);
+	memory_free(MEMORY_SCRATCH, keys);
+	memory_free(MEMORY_SCRATCH, neighbours);
+	return 0;
+}
+
+
+/**
+ * Max heap of (key, page) pairs for order_gorder, stale pairs are skipped when popped
+ */
+struct gorder_heap {
+	int size;
+	int capacity;
+	long long* items;	// key << 32 | page
+};
+
+
+/**
+ * Push a pair onto the heap, growing it if needed
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int gorder_heap_push(struct gorder_heap* heap, int key, int v) {
+	if (heap->size == heap->capacity) {
+		long long* items = memory_realloc(MEMORY_SCRATCH, heap->items, sizeof(long long) * heap->capacity * 2);
+		if (items == NULL) {
+			return -1;
+		}
+		heap->items = items;
+		heap->capacity *= 2;
+	}
+	long long item = ((long long)key << 32) | v;
+	int i = heap->size++;
+	while (i > 0 && heap->items[(i - 1) / 2] < item) {
+		heap->items[i] = heap->items[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap->items[i] = item;
+	return 0;
+}
+
+
+/**
+ * Pop the largest pair off the heap
+ */
+static long long gorder_heap_pop(struct gorder_heap* heap) {
+	long long top = heap->items[0];
+	long long item = heap->items[--heap->size];
+	int i = 0;
+	while (2 * i + 1 < heap->size) {
+		int child = 2 * i + 1;
+		if (child + 1 < heap->size && heap->items[child + 1] > heap->items[child]) {
+			child++;
+		}
+		if (heap->items[child] <= item) {
+			break;
+		}
+		heap->items[i] = heap->items[child];
+		i = child;
+	}
+	heap->items[i] = item;
+	return top;
+}
+
+
+/**
+ * Add delta to the gorder score of every unplaced page related to page u: its inlinks, its
+ * outlinks and its siblings (pages sharing an inlink with u, skipping hubs which relate everything)
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int gorder_update(struct csr* graph, int u, int delta, int* keys, const char* placed,
+		struct gorder_heap* heap, int hub_limit) {
+	int failed = 0;
+	for (int e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+		int x = graph->sources[e];
+		if (!placed[x]) {
+			keys[x] += delta;
+			failed |= gorder_heap_push(heap, keys[x], x);
+		}
+		if (graph->out_offsets[x + 1] - graph->out_offsets[x] > hub_limit) {
+			continue;
+		}
+		for (int f = graph->out_offsets[x]; f < graph->out_offsets[x + 1]; f++) {
+			int w = graph->targets[f];
+			if (!placed[w]) {
+				keys[w] += delta;
+				failed |= gorder_heap_push(heap, keys[w], w);
+			}
+		}
+	}
+	for (int e = graph->out_offsets[u]; e < graph->out_offsets[u + 1]; e++) {
+		int w = graph->targets[e];
+		if (!placed[w]) {
+			keys[w] += delta;
+			failed |= gorder_heap_push(heap, keys[w], w);
+		}
+	}
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * Order the pages greedily with a Gorder like heuristic: each next page is the one sharing the
+ * most links and inlinks with the last GORDER_WINDOW pages placed, falling back to the highest
+ * degree page left when nothing is related
+ * @param graph, the csr with outlinks built
+ * @param order, filled with the old index of the page to put at each new index
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int order_gorder(struct csr* graph, int* order) {
+	int npages = graph->npages;
+	int hub_limit = (int)sqrt((double)npages) + 1;
+	int* keys = memory_calloc(MEMORY_SCRATCH, npages, sizeof(int));
+	char* placed = memory_calloc(MEMORY_SCRATCH, npages, sizeof(char));
+	int* by_degree = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	struct gorder_heap heap = { 0, 1024, memory_malloc(MEMORY_SCRATCH, sizeof(long long) * 1024) };
+	int failed = keys == NULL || placed == NULL || by_degree == NULL || heap.items == NULL;
+
+	failed = failed || order_degree(graph, by_degree) != 0;
+
+	int next_seed = 0;
+	for (int k = 0; !failed && k < npages; k++) {
+		int v = -1;
+		while (heap.size > 0 && v < 0) {
+			long long item = gorder_heap_pop(&heap);
+			int candidate = (int)(item & 0xFFFFFFFF);
+			int key = (int)(item >> 32);
+			if (!placed[candidate] && keys[candidate] == key && key > 0) {
+				v = candidate;
+			}
+		}
+		while (v < 0) {
+			if (!placed[by_degree[next_seed]]) {
+				v = by_degree[next_seed];
+			}
+			next_seed++;
+		}
+
+		placed[v] = 1;
+		order[k] = v;
+		failed |= gorder_update(graph, v, 1, keys, placed, &heap, hub_limit);
+		if (k >= GORDER_WINDOW) {
+			failed |= gorder_update(graph, order[k - GORDER_WINDOW], -1, keys, placed, &heap, hub_limit);
+		}
+
+		// Drop the stale pairs once they outnumber the pages
+		if (heap.size > 4 * npages + 1024) {
+			heap.size = 0;
+			for (int i = 0; i < npages && !failed; i++) {
+				if (!placed[i] && keys[i] > 0) {
+					failed |= gorder_heap_push(&heap, keys[i], i);
+				}
+			}
+		}
+	}
+
+	memory_free(MEMORY_SCRATCH, keys);
+	memory_free(MEMORY_SCRATCH, placed);
+	memory_free(MEMORY_SCRATCH, by_degree);
+	memory_free(MEMORY_SCRATCH, heap.items);
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * Relabel the pages of a csr so page order[k] becomes page k
+ * The old index of every page is kept in positions so results can be printed in input order.
+ * @param graph, the csr
+ * @param order, the old index of the page to put at each new index
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+int csr_reorder(struct csr* graph, const int* order) {
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	int* positions = memory_malloc(MEMORY_PAGES, sizeof(int) * npages);
+	int* offsets = memory_malloc(MEMORY_PAGES, sizeof(int) * (npages + 1));
+	int* sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1));
+	int* weights = graph->weights != NULL ? memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1)) : NULL;
+	double* inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * npages);
+	page** pages = memory_malloc(MEMORY_PAGES, sizeof(page*) * npages);
+	if (positions == NULL || offsets == NULL || sources == NULL || (graph->weights != NULL && weights == NULL)
+			|| inv_outlinks == NULL || pages == NULL) {
+		memory_free(MEMORY_PAGES, positions);
+		memory_free(MEMORY_PAGES, offsets);
+		memory_free(MEMORY_EDGES, sources);
+		memory_free(MEMORY_EDGES, weights);
+		memory_free(MEMORY_PAGES, inv_outlinks);
+		memory_free(MEMORY_PAGES, pages);
+		return -1;
+	}
+
+	for (int k = 0; k < npages; k++) {
+		positions[order[k]] = k;
+	}
+
+	int edge = 0;
+	for (int k = 0; k < npages; k++) {
+		int i = order[k];
+		offsets[k] = edge;
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			if (weights != NULL) {
+				weights[edge] = graph->weights[e];
+			}
+			sources[edge++] = positions[graph->sources[e]];
+		}
+		inv_outlinks[k] = graph->inv_outlinks[i];
+		pages[k] = graph->pages[i];
+	}
+	offsets[npages] = edge;
+
+	// Compose with any earlier relabelling
+	if (graph->positions != NULL) {
+		for (int i = 0; i < npages; i++) {
+			graph->positions[i] = positions[graph->positions[i]];
+		}
+		memory_free(MEMORY_PAGES, positions);
+	} else {
+		graph->positions = positions;
+	}
+
+	memory_free(MEMORY_PAGES, graph->offsets);
+	memory_free(MEMORY_EDGES, graph->sources);
+	memory_free(MEMORY_EDGES, graph->weights);
+	memory_free(MEMORY_PAGES, graph->inv_outlinks);
+	memory_free(MEMORY_PAGES, graph->pages);
+	memory_free(MEMORY_PAGES, graph->out_offsets);
+	memory_free(MEMORY_EDGES, graph->targets);
+	graph->offsets = offsets;
+	graph->sources = sources;
+	graph->weights = weights;
+	graph->inv_outlinks = inv_outlinks;
+	graph->pages = pages;
+	graph->out_offsets = NULL;
+	graph->targets = NULL;
+	return 0;
+}
+
+
+/**
+ * Build a csr from the pages (or take the one read_input_parallel built), merge its repeated
+ * edges as coalesce_edges says and relabel it with the reorder_method picked on the command line
+ * The time spent reordering is reported on stderr so it can be weighed against the kernel.
+ * @param plist, the list of pages
+ * @param npages, the number of pages
+ * @param nedges, the number of edges
+ * @return the csr, or NULL if an allocation fails
+ */
+struct csr* csr_prepare(list* plist, int npages, int nedges) {
+	struct csr* graph = loaded_graph != NULL ? loaded_graph : csr_create(plist, npages, nedges);
+	loaded_graph = NULL;
+	if (graph != NULL && coalesce_edges != COALESCE_NONE && csr_coalesce(graph, coalesce_edges == COALESCE_DROP_LOOPS) != 0) {
+		csr_destroy(graph);
+		return NULL;
+	}
+	if (graph == NULL || reorder_method == REORDER_NONE) {
+		return graph;
+	}
+
+	double start = omp_get_wtime();
+	int* order = memory_malloc(MEMORY_PAGES, sizeof(int) * npages);
+	int failed = order == NULL;
+	if (!failed && reorder_method == REORDER_DEGREE) {
+		failed = order_degree(graph, order) != 0;
+	} else if (!failed && reorder_method == REORDER_RCM) {
+		failed = csr_build_outlinks(graph) != 0 || order_rcm(graph, order) != 0;
+	} else if (!failed) {
+		failed = csr_build_outlinks(graph) != 0 || order_gorder(graph, order) != 0;
+	}
+
+	if (failed || csr_reorder(graph, order) != 0) {
+		memory_free(MEMORY_PAGES, order);
+		csr_destroy(graph);
+		return NULL;
+	}
+	memory_free(MEMORY_PAGES, order);
+	fprintf(stderr, "reorder %lf\n", omp_get_wtime() - start);
+	return graph;
+}
+
+
+#define PRINT_CHUNK 4096	// pages formatted at a time by each thread with -P
+
+
+/**
+ * Print the scores of a csr to stdout in input order
+ * With -P the threads format chunks of PRINT_CHUNK pages into memory, and each chunk is
+ * written as soon as the ones before it have been, while the threads format the next ones.
+ * @param graph, the csr
+ * @param scores, the score of each page of the csr
+ */
+void csr_print_scores(struct csr* graph, const double* scores) {
+	if (!pipeline_input) {
+		for (int i = 0; i < graph->npages; i++) {
+			int k = graph->positions != NULL ? graph->positions[i] : i;
+			printf("%s %.4lf\n", string_table_get(graph->names, i), scores[k]);
+		}
+		return;
+	}
+
+	int nchunks = (graph->npages + PRINT_CHUNK - 1) / PRINT_CHUNK;
+	#pragma omp parallel for ordered schedule(static, 1)
+	for (int c = 0; c < nchunks; c++) {
+		int first = c * PRINT_CHUNK;
+		int last = first + PRINT_CHUNK < graph->npages ? first + PRINT_CHUNK : graph->npages;
+		char* text = NULL;
+		size_t length = 0;
+		FILE* chunk = open_memstream(&text, &length);
+		for (int i = first; i < last && chunk != NULL; i++) {
+			int k = graph->positions != NULL ? graph->positions[i] : i;
+			fprintf(chunk, "%s %.4lf\n", string_table_get(graph->names, i), scores[k]);
+		}
+		if (chunk != NULL && fclose(chunk) != 0) {
+			free(text);
+			text = NULL;
+		}
+
+		// Fall back on printing the chunk directly if it could not be formatted in memory
+		#pragma omp ordered
+		{
+			if (text != NULL) {
+				fwrite(text, 1, length, stdout);
+			} else {
+				for (int i = first; i < last; i++) {
+					int k = graph->positions != NULL ? graph->positions[i] : i;
+					printf("%s %.4lf\n", string_table_get(graph->names, i), scores[k]);
+				}
+			}
+		}
+		free(text);
+	}
+}
+
+
+#define MAX_DAMPENERS 16
+
+
+/**
+ * PageRank algorithm for several dampening effects at once
+ * Scores are interleaved per page (scores[i * ndampeners + k]) so every inlink is loaded
+ * once per iteration and applied to all dampening effects with SIMD. Each dampening effect
+ * stops updating once it has converged so its scores match a run on its own.
+ * @param plist, list of pages
+ * @param ncores, number of cores
+ * @param npages, number of pages
+ * @param nedges, number of edges
+ * @param dampeners, the dampening effects to rank with
+ * @param ndampeners, number of dampening effects (at most MAX_DAMPENERS)
+ */
+void pagerank_batch(list* plist, int ncores, int npages, int nedges, const double* dampeners, int ndampeners) {
+	// Check for invalid parameters
+	if (plist == NULL || ncores <= 0 || npages <= 0 || nedges < 0 || dampeners == NULL
+			|| ndampeners <= 0 || ndampeners > MAX_DAMPENERS) {
+		return;
+	}
+	for (int k = 0; k < ndampeners; k++) {
+		if (dampeners[k] <= 0 || dampeners[k] > 1) {
+			return;
+		}
+	}
+
+	struct csr* graph = csr_prepare(plist, npages, nedges);
+	double* scores[2];
+	scores[0] = memory_malloc(MEMORY_SCORES, sizeof(double) * npages * ndampeners);
+	scores[1] = memory_malloc(MEMORY_SCORES, sizeof(double) * npages * ndampeners);
+	if (graph == NULL || scores[0] == NULL || scores[1] == NULL) {
+		csr_destroy(graph);
+		memory_free(MEMORY_SCORES, scores[0]);
+		memory_free(MEMORY_SCORES, scores[1]);
+		return;
+	}
+
+	const int K = ndampeners;
+	double dampening_value[MAX_DAMPENERS];
+	double converged[MAX_DAMPENERS];	// 1.0 once the dampening effect has converged
+	double diff[MAX_DAMPENERS];
+	for (int k = 0; k < K; k++) {
+		dampening_value[k] = (1.0 - dampeners[k]) / ((double)npages);
+		converged[k] = 0.0;
+	}
+
+	double initial_value = 1 / (double)npages;
+	#pragma omp parallel for num_threads(ncores)
+	for (int i = 0; i < npages * K; i++) {
+		scores[0][i] = initial_value;
+		scores[1][i] = initial_value;
+	}
+
+	int x = 1;
+	int remaining = K;
+
+	// Loop through until every dampening effect has converged
+	while (remaining > 0) {
+		const double* old_scores = scores[!x];
+		double* new_scores = scores[x];
+		for (int k = 0; k < K; k++) {
+			diff[k] = 0.0;
+		}
+
+		#pragma omp parallel for num_threads(ncores) reduction(+:diff[:MAX_DAMPENERS])
+		for (int i = 0; i < npages; i++) {
+			double total[MAX_DAMPENERS] = { 0.0 };
+
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int src = graph->sources[e];
+				double weight = graph->inv_outlinks[src];
+				const double* src_scores = &old_scores[(size_t)src * K];
+
+				#pragma omp simd
+				for (int k = 0; k < K; k++) {
+					total[k] += src_scores[k] * weight;
+				}
+			}
+
+			const double* prev = &old_scores[(size_t)i * K];
+			double* next = &new_scores[(size_t)i * K];
+
+			#pragma omp simd
+			for (int k = 0; k < K; k++) {
+				double score = dampening_value[k] + total[k] * dampeners[k];
+				next[k] = converged[k] ? prev[k] : score;
+				diff[k] += (next[k] - prev[k]) * (next[k] - prev[k]);
+			}
+		}
+
+		for (int k = 0; k < K; k++) {
+			if (!converged[k] && sqrt(diff[k]) <= EPSILON) {
+				converged[k] = 1.0;
+				remaining--;
+			}
+		}
+		x = !x;	// Update the value so we do not have to copy
+	}
+
+	// Print the results to stdout, one column per dampening effect
+	const double* final_scores = scores[!x];
+	for (int i = 0; i < npages; i++) {
+		int page = graph->positions != NULL ? graph->positions[i] : i;
+		printf("%s", string_table_get(graph->names, i));
+		for (int k = 0; k < K; k++) {
+			printf(" %.4lf", final_scores[(size_t)page * K + k]);
+		}
+		printf("\n");
+	}
+
+	memory_free(MEMORY_SCORES, scores[0]);
+	memory_free(MEMORY_SCORES, scores[1]);
+	csr_destroy(graph);
+}
+
+
+/**
+ * Split of the inlinks of a csr into parts of roughly equal work
+ * Part t sweeps inlinks edge_bounds[t] .. edge_bounds[t + 1] - 1 of the pages first_pages[t] ..
+ * end_pages[t] - 1. When hubs are split a page's inlinks may be shared by several parts, each
+ * of which sums its share into a partial that is reduced after the sweep.
+ */
+struct csr_partition {
+	int nparts;
+	int* edge_bounds;
+	int* first_pages;
+	int* end_pages;
+};
+
+
+/**
+ * Clean up an allocated csr partition
+ * @param partition, the partition to free
+ */
+void csr_partition_destroy(struct csr_partition* partition) {
+	if (partition == NULL) {
+		return;
+	}
+	memory_free(MEMORY_SCRATCH, partition->edge_bounds);
+	memory_free(MEMORY_SCRATCH, partition->first_pages);
+	memory_free(MEMORY_SCRATCH, partition->end_pages);
+	memory_free(MEMORY_SCRATCH, partition);
+}
+
+
+/**
+ * Split a csr into parts of roughly equal work using the prefix sums of the inlinks (the offsets)
+ * Without hub splitting every page costs its inlinks plus one and parts end on page boundaries,
+ * so one hub can still make its part heavy. With hub splitting parts get exactly equal inlinks
+ * and a hub's inlinks are shared by as many parts as they span.
+ * @param graph, the csr
+ * @param nparts, the number of parts
+ * @param split_hubs, whether pages may be split across parts
+ * @return the partition, or NULL if an allocation fails
+ */
+struct csr_partition* csr_partition_create(struct csr* graph, int nparts, int split_hubs) {
+	struct csr_partition* partition = memory_malloc(MEMORY_SCRATCH, sizeof(struct csr_partition));
+	if (partition == NULL) {
+		return NULL;
+	}
+	partition->nparts = nparts;
+	partition->edge_bounds = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (nparts + 1));
+	partition->first_pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (nparts + 1));
+	partition->end_pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (nparts + 1));
+	if (partition->edge_bounds == NULL || partition->first_pages == NULL || partition->end_pages == NULL) {
+		csr_partition_destroy(partition);
+		return NULL;
+	}
+
+	int npages = graph->npages;
+	long nedges = graph->offsets[npages];
+	for (int t = 0; t <= nparts; t++) {
+		int low = 0;
+		int high = npages;
+		if (split_hubs) {
+			// First page with inlinks at or after the bound, which may have started before it
+			int bound = (int)(nedges * t / nparts);
+			while (low < high) {
+				int mid = low + (high - low) / 2;
+				if (graph->offsets[mid + 1] > bound || graph->offsets[mid] >= bound) {
+					high = mid;
+				} else {
+					low = mid + 1;
+				}
+			}
+			partition->edge_bounds[t] = bound;
+			partition->first_pages[t] = low;
+
+			// The previous part ends before the first page starting at or after the bound
+			low = 0;
+			high = npages;
+			while (low < high) {
+				int mid = low + (high - low) / 2;
+				if (graph->offsets[mid] >= bound) {
+					high = mid;
+				} else {
+					low = mid + 1;
+				}
+			}
+			if (t > 0) {
+				partition->end_pages[t - 1] = low;
+			}
+		} else {
+			// First page whose cost prefix (inlinks + pages before it) reaches the target
+			long target = (nedges + npages) * t / nparts;
+			while (low < high) {
+				int mid = low + (high - low) / 2;
+				if ((long)graph->offsets[mid] + mid >= target) {
+					high = mid;
+				} else {
+					low = mid + 1;
+				}
+			}
+			partition->edge_bounds[t] = graph->offsets[low];
+			partition->first_pages[t] = low;
+			if (t > 0) {
+				partition->end_pages[t - 1] = low;
+			}
+		}
+	}
+	partition->edge_bounds[nparts] = (int)nedges;
+	partition->end_pages[nparts - 1] = npages;
+	return partition;
+}
+
+
+/**
+ * Sweep one part of a partition, pulling the new score of every page it owns outright
+ * Pages sharing inlinks with a neighbouring part leave their partial sum in the part's two
+ * split slots (split_pages[2 * t] at its start, split_pages[2 * t + 1] at its end, -1 if unused).
+ * @return the sum of the squared changes of the pages finished by this part
+ */
+static double csr_partition_sweep(struct csr* graph, struct csr_partition* partition, int t,
+		const double* old_scores, double* new_scores, double dampening_value, double dampener,
+		int* split_pages, double* split_sums) {
+	int first_edge = partition->edge_bounds[t];
+	int last_edge = partition->edge_bounds[t + 1];
+	int last_part = t == partition->nparts - 1;
+	double diff = 0.0;
+
+	split_pages[2 * t] = -1;
+	split_pages[2 * t + 1] = -1;
+
+	for (int i = partition->first_pages[t]; i < partition->end_pages[t]; i++) {
+		int low = graph->offsets[i] > first_edge ? graph->offsets[i] : first_edge;
+		int high = graph->offsets[i + 1] < last_edge ? graph->offsets[i + 1] : last_edge;
+
+		double total = 0.0;
+		for (int e = low; e < high; e++) {
+			int src = graph->sources[e];
+			total += old_scores[src] * graph->inv_outlinks[src];
+		}
+
+		if (graph->offsets[i] < first_edge) {
+			split_pages[2 * t] = i;
+			split_sums[2 * t] = total;
+		} else if (graph->offsets[i + 1] > last_edge && !last_part) {
+			split_pages[2 * t + 1] = i;
+			split_sums[2 * t + 1] = total;
+		} else {
+			new_scores[i] = dampening_value + total * dampener;
+			diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+		}
+	}
+	return diff;
+}
+
+/**
+ * Reduce the partial sums left in the split slots by csr_partition_sweep and finish those pages
+ * The slots of one page are next to each other, with unused (-1) slots possibly in between.
+ * @return the sum of the squared changes of the split pages
+ */
+static double csr_partition_reduce(int nparts, const int* split_pages, const double* split_sums,
+		const double* old_scores, double* new_scores, double dampening_value, double dampener) {
+	double diff = 0.0;
+	for (int slot = 0; slot < 2 * nparts; ) {
+		int i = split_pages[slot];
+		if (i < 0) {
+			slot++;
+			continue;
+		}
+		double total = 0.0;
+		for (; slot < 2 * nparts && (split_pages[slot] == i || split_pages[slot] < 0); slot++) {
+			total += split_pages[slot] == i ? split_sums[slot] : 0.0;
+		}
+		new_scores[i] = dampening_value + total * dampener;
+		diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+	}
+	return diff;
+}
+
+
+/**
+ * Deque of task indices owned by one worker
+ * Both ends are packed into one word (head << 32 | tail) so the owner taking from the head and
+ * thieves stealing from the tail each claim a task with a single compare and swap. Tasks are
+ * only added by ws_pool_reset between sweeps so the deque never grows while it is being used.
+ */
+struct ws_deque {
+	_Atomic unsigned long long ends;
+	char filler[64 - sizeof(unsigned long long)];	// one deque per cache line
+};
+
+
+/**
+ * Work stealing pool handing out the tasks of a sweep to a team of workers
+ */
+struct ws_pool {
+	int nworkers;
+	int ntasks;
+	struct ws_deque* deques;
+};
+
+
+/**
+ * Clean up an allocated work stealing pool
+ * @param pool, the pool to free
+ */
+void ws_pool_destroy(struct ws_pool* pool) {
+	if (pool == NULL) {
+		return;
+	}
+	memory_free(MEMORY_SCRATCH, pool->deques);
+	memory_free(MEMORY_SCRATCH, pool);
+}
+
+
+/**
+ * Give every worker its contiguous share of the tasks again, ready for the next sweep
+ * Must not be called while workers are taking tasks.
+ * @param pool, the pool
+ */
+void ws_pool_reset(struct ws_pool* pool) {
+	for (int w = 0; w < pool->nworkers; w++) {
+		unsigned long long head = (unsigned long long)pool->ntasks * w / pool->nworkers;
+		unsigned long long tail = (unsigned long long)pool->ntasks * (w + 1) / pool->nworkers;
+		atomic_store_explicit(&pool->deques[w].ends, head << 32 | tail, memory_order_relaxed);
+	}
+	atomic_thread_fence(memory_order_release);
+}
+
+
+/**
+ * Create a work stealing pool of ntasks tasks shared between nworkers workers
+ * @param nworkers, the number of workers
+ * @param ntasks, the number of tasks in each sweep
+ * @return the pool, or NULL if an allocation fails
+ */
+struct ws_pool* ws_pool_create(int nworkers, int ntasks) {
+	struct ws_pool* pool = memory_malloc(MEMORY_SCRATCH, sizeof(struct ws_pool));
+	if (pool == NULL) {
+		return NULL;
+	}
+	pool->nworkers = nworkers;
+	pool->ntasks = ntasks;
+	pool->deques = memory_aligned_alloc(MEMORY_SCRATCH, 64, sizeof(struct ws_deque) * nworkers);
+	if (pool->deques == NULL) {
+		ws_pool_destroy(pool);
+		return NULL;
+	}
+	for (int w = 0; w < nworkers; w++) {
+		atomic_init(&pool->deques[w].ends, 0);
+	}
+	ws_pool_reset(pool);
+	return pool;
+}
+
+
+/**
+ * Claim a task from one end of a deque
+ * @param deque, the deque
+ * @param steal, whether to take from the tail (thief) rather than the head (owner)
+ * @return the task, or -1 if the deque is empty
+ */
+static int ws_deque_take(struct ws_deque* deque, int steal) {
+	unsigned long long ends = atomic_load_explicit(&deque->ends, memory_order_acquire);
+	for (;;) {
+		unsigned long long head = ends >> 32;
+		unsigned long long tail = ends & 0xFFFFFFFF;
+		if (head >= tail) {
+			return -1;
+		}
+		unsigned long long claimed = steal ? (head << 32 | (tail - 1)) : ((head + 1) << 32 | tail);
+		if (atomic_compare_exchange_weak_explicit(&deque->ends, &ends, claimed,
+				memory_order_acq_rel, memory_order_acquire)) {
+			return (int)(steal ? tail - 1 : head);
+		}
+	}
+}
+
+
+/**
+ * Get the next task for a worker, taking from its own deque first and then stealing from
+ * the tails of the others
+ * @param pool, the pool
+ * @param worker, the worker asking, 0 .. nworkers - 1
+ * @return the task, or -1 once every deque is empty
+ */
+int ws_next(struct ws_pool* pool, int worker) {
+	int task = ws_deque_take(&pool->deques[worker % pool->nworkers], 0);
+	for (int i = 1; task < 0 && i < pool->nworkers; i++) {
+		task = ws_deque_take(&pool->deques[(worker + i) % pool->nworkers], 1);
+	}
+	return task;
+}
+
+
+
+#define PUSH_ONLY 0
+#define PUSH_ADAPTIVE 1
+#define TASKS_PER_THREAD 8	// edge balanced page ranges per thread in a work stealing sweep
+
+
+/**
+ * Push (scatter) based PageRank over the outlinks of a csr
+ * Rather than recomputing every page from its inlinks, each iteration pushes the change in
+ * score of the still changing (active) pages along their outlinks. Each thread scatters into
+ * its own accumulator so no atomics are needed on the sums, and the first time a thread adds to
+ * a page it claims the page, once for all threads, into a list of the pages pushed into. Only
+ * those are reduced, so an iteration costs the active edges plus the touched pages times the
+ * threads rather than every page times the threads. A page whose pending change is at most
+ * EPSILON * (1 - dampener) / npages is left until more arrives, which keeps pages that have all
+ * but stopped changing out of the active list without moving the result. The first iteration
+ * pulls from the initial scores, and with PUSH_ADAPTIVE a pull over the inlinks is also used
+ * whenever pushing the active pages costs more than pulling every edge.
+ * @param graph, the csr with outlinks built
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param mode, PUSH_ONLY or PUSH_ADAPTIVE
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int push_pull_rank(struct csr* graph, int ncores, double dampener, int mode, double* scores) {
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	omp_set_num_threads(ncores);
+	int nthreads = omp_get_max_threads();
+
+	double* next = memory_malloc(MEMORY_SCORES, sizeof(double) * npages);
+	double* pending = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages);	// change in score not yet pushed
+	double* accumulators = memory_calloc(MEMORY_SCRATCH, (size_t)npages * nthreads, sizeof(double));
+	int* active = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);		// pages to push
+	int* touched = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);		// pages pushed into
+	unsigned char* claimed = memory_calloc(MEMORY_SCRATCH, npages, 1);
+
+	// Pulls are shared out as edge balanced page ranges through a work stealing pool
+	int ntasks = nthreads * TASKS_PER_THREAD;
+	struct csr_partition* partition = csr_partition_create(graph, ntasks, 0);
+	struct ws_pool* pool = ws_pool_create(nthreads, ntasks);
+	int* split_pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * 2 * ntasks);
+	double* split_sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * ntasks);
+	if (next == NULL || pending == NULL || accumulators == NULL || active == NULL || touched == NULL || claimed == NULL
+			|| partition == NULL || pool == NULL || split_pages == NULL || split_sums == NULL) {
+		memory_free(MEMORY_SCORES, next);
+		memory_free(MEMORY_SCRATCH, pending);
+		memory_free(MEMORY_SCRATCH, accumulators);
+		memory_free(MEMORY_SCRATCH, active);
+		memory_free(MEMORY_SCRATCH, touched);
+		memory_free(MEMORY_SCRATCH, claimed);
+		csr_partition_destroy(partition);
+		ws_pool_destroy(pool);
+		memory_free(MEMORY_SCRATCH, split_pages);
+		memory_free(MEMORY_SCRATCH, split_sums);
+		return -1;
+	}
+
+	// Changes held back under the tolerance move the fixed point by at most EPSILON / npages
+	double tolerance = EPSILON * (1.0 - dampener) / npages;
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int pull = 1;
+	int nactive = 0;
+	long active_edges = 0;
+	for (int done = 0; !done;) {
+		double diff = 0.0;
+
+		if (pull) {
+			// Pull: recompute every page from its inlinks, no page is split between tasks
+			ws_pool_reset(pool);
+			#pragma omp parallel
+			{
+				int task;
+				while ((task = ws_next(pool, omp_get_thread_num())) >= 0) {
+					csr_partition_sweep(graph, partition, task, scores, next, dampening_value,
+							dampener, split_pages, split_sums);
+				}
+			}
+
+			// Every page may have changed, and its change is all that is left to push
+			nactive = 0;
+			active_edges = 0;
+			#pragma omp parallel for reduction(+:diff, active_edges)
+			for (int i = 0; i < npages; i++) {
+				double change = next[i] - scores[i];
+				pending[i] = change;
+				scores[i] = next[i];
+				diff += change * change;
+				if (fabs(change) > tolerance) {
+					int slot;
+					#pragma omp atomic capture
+					slot = nactive++;
+					active[slot] = i;
+					active_edges += graph->out_offsets[i + 1] - graph->out_offsets[i];
+				}
+			}
+		} else {
+			// Push: scatter the pending changes of the active pages into per thread accumulators
+			int ntouched = 0;
+			#pragma omp parallel
+			{
+				double* accumulator = &accumulators[(size_t)omp_get_thread_num() * npages];
+
+				#pragma omp for schedule(dynamic, 64)
+				for (int a = 0; a < nactive; a++) {
+					int src = active[a];
+					double contribution = pending[src] * graph->inv_outlinks[src] * dampener;
+					pending[src] = 0.0;
+					for (int e = graph->out_offsets[src]; e < graph->out_offsets[src + 1]; e++) {
+						int dst = graph->targets[e];
+						if (accumulator[dst] == 0.0) {
+							unsigned char was_claimed;
+							#pragma omp atomic capture
+							{ was_claimed = claimed[dst]; claimed[dst] = 1; }
+							if (!was_claimed) {
+								int slot;
+								#pragma omp atomic capture
+								slot = ntouched++;
+								touched[slot] = dst;
+							}
+						}
+						accumulator[dst] += contribution;
+					}
+				}
+
+				// Reduce the accumulators of the touched pages only, clearing them for the next iteration
+				#pragma omp for reduction(+:diff)
+				for (int k = 0; k < ntouched; k++) {
+					int i = touched[k];
+					double total = 0.0;
+					for (int t = 0; t < nthreads; t++) {
+						total += accumulators[(size_t)t * npages + i];
+						accumulators[(size_t)t * npages + i] = 0.0;
+					}
+					claimed[i] = 0;
+					scores[i] += total;
+					pending[i] += total;
+					diff += total * total;
+				}
+			}
+
+			// Every active page was pushed, so only touched pages can have a change worth pushing
+			nactive = 0;
+			active_edges = 0;
+			for (int k = 0; k < ntouched; k++) {
+				int i = touched[k];
+				if (fabs(pending[i]) > tolerance) {
+					active[nactive++] = i;
+					active_edges += graph->out_offsets[i + 1] - graph->out_offsets[i];
+				}
+			}
+		}
+		diff = sqrt(diff);
+
+		// Push again unless every edge costs less to pull than the active ones do to push
+		long push_cost = active_edges + (active_edges < npages ? active_edges : npages) * (long)nthreads;
+		long pull_cost = (long)nedges + npages;
+		done = diff <= EPSILON;
+		pull = (mode == PUSH_ADAPTIVE && push_cost > pull_cost);
+	}
+
+	memory_free(MEMORY_SCORES, next);
+	memory_free(MEMORY_SCRATCH, pending);
+	memory_free(MEMORY_SCRATCH, accumulators);
+	memory_free(MEMORY_SCRATCH, active);
+	memory_free(MEMORY_SCRATCH, touched);
+	memory_free(MEMORY_SCRATCH, claimed);
+	csr_partition_destroy(partition);
+	ws_pool_destroy(pool);
+	memory_free(MEMORY_SCRATCH, split_pages);
+	memory_free(MEMORY_SCRATCH, split_sums);
+	return 0;
+}
+
+
+/**
+ * Rank a csr by pulling over the inlinks of every page
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	int nblocks = (npages + SUM_BLOCK - 1) / SUM_BLOCK;
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	double* block_sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * nblocks);	// residual then change of each block
+	if (buffers[1] == NULL || block_sums == NULL) {
+		memory_free(MEMORY_SCORES, buffers[1]);
+		memory_free(MEMORY_SCRATCH, block_sums);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	double diff = 1;
+	double change;
+	struct budget budget;
+	budget_start(&budget);
+
+	// Loop through until the convergence threshold is reached or the budget runs out
+	for (int done = 0; !done;) {
+		diff = 0.0;
+		change = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		if (deterministic_sums) {
+			// Same blocks summed in the same order whatever the number of threads
+			#pragma omp parallel for schedule(dynamic, 1)
+			for (int block = 0; block < nblocks; block++) {
+				int end = (block + 1) * SUM_BLOCK < npages ? (block + 1) * SUM_BLOCK : npages;
+				double block_diff = 0.0;
+				double block_change = 0.0;
+				for (int i = block * SUM_BLOCK; i < end; i++) {
+					double total = 0.0;
+					for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+						int src = graph->sources[e];
+						total += old_scores[src] * graph->inv_outlinks[src];
+					}
+					new_scores[i] = dampening_value + total * dampener;
+					block_diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+					block_change += fabs(new_scores[i] - old_scores[i]);
+				}
+				block_sums[block] = block_diff;
+				block_sums[nblocks + block] = block_change;
+			}
+			diff = pairwise_sum(block_sums, nblocks);
+			change = pairwise_sum(block_sums + nblocks, nblocks);
+		} else {
+			#pragma omp parallel for reduction(+:diff, change)
+			for (int i = 0; i < npages; i++) {
+				double total = 0.0;
+				for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+					int src = graph->sources[e];
+					total += old_scores[src] * graph->inv_outlinks[src];
+				}
+				new_scores[i] = dampening_value + total * dampener;
+				diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+				change += fabs(new_scores[i] - old_scores[i]);
+			}
+		}
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+		done = budget_done(&budget, dampener, diff, change);
+	}
+	budget_report(&budget);
+
+	if (buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	memory_free(MEMORY_SCORES, buffers[1]);
+	memory_free(MEMORY_SCRATCH, block_sums);
+	return 0;
+}
+
+
+/**
+ * Sum the weighted contributions of the inlinks of a page
+ * @param graph, the csr, whose weights are all one when it has none
+ * @param scores, the scores of the last iteration
+ * @param page, the index of the page
+ * @return the sum of score * weight / outlink weight over the inlinks
+ */
+static inline double csr_weighted_pull(const struct csr* graph, const double* scores, int page) {
+	double total = 0.0;
+	if (graph->weights == NULL) {
+		for (int e = graph->offsets[page]; e < graph->offsets[page + 1]; e++) {
+			int src = graph->sources[e];
+			total += scores[src] * graph->inv_outlinks[src];
+		}
+		return total;
+	}
+	for (int e = graph->offsets[page]; e < graph->offsets[page + 1]; e++) {
+		int src = graph->sources[e];
+		total += scores[src] * graph->inv_outlinks[src] * (double)graph->weights[e];
+	}
+	return total;
+}
+
+
+/**
+ * Rank a csr whose repeated inlinks were merged by csr_coalesce, pulling each inlink once times
+ * its weight
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_weighted_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	int nblocks = (npages + SUM_BLOCK - 1) / SUM_BLOCK;
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	double* block_sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * nblocks);	// residual then change of each block
+	if (buffers[1] == NULL || block_sums == NULL) {
+		memory_free(MEMORY_SCORES, buffers[1]);
+		memory_free(MEMORY_SCRATCH, block_sums);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	double diff = 1;
+	double change;
+	struct budget budget;
+	budget_start(&budget);
+	for (int done = 0; !done;) {
+		diff = 0.0;
+		change = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		if (deterministic_sums) {
+			#pragma omp parallel for schedule(dynamic, 1)
+			for (int block = 0; block < nblocks; block++) {
+				int end = (block + 1) * SUM_BLOCK < npages ? (block + 1) * SUM_BLOCK : npages;
+				double block_diff = 0.0;
+				double block_change = 0.0;
+				for (int i = block * SUM_BLOCK; i < end; i++) {
+					new_scores[i] = dampening_value + csr_weighted_pull(graph, old_scores, i) * dampener;
+					block_diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+					block_change += fabs(new_scores[i] - old_scores[i]);
+				}
+				block_sums[block] = block_diff;
+				block_sums[nblocks + block] = block_change;
+			}
+			diff = pairwise_sum(block_sums, nblocks);
+			change = pairwise_sum(block_sums + nblocks, nblocks);
+		} else {
+			#pragma omp parallel for reduction(+:diff, change)
+			for (int i = 0; i < npages; i++) {
+				new_scores[i] = dampening_value + csr_weighted_pull(graph, old_scores, i) * dampener;
+				diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+				change += fabs(new_scores[i] - old_scores[i]);
+			}
+		}
+
+		x = !x;
+		diff = sqrt(diff);
+		done = budget_done(&budget, dampener, diff, change);
+	}
+	budget_report(&budget);
+
+	if (buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	memory_free(MEMORY_SCORES, buffers[1]);
+	memory_free(MEMORY_SCRATCH, block_sums);
+	return 0;
+}
+
+
+/**
+ * Rank a csr by pulling over the inlinks of every page with single precision scores
+ * Scores and the contribution (score / noutlinks) of every page are stored as floats, halving
+ * the bytes of each gather, while the residual is still summed in double. With refine the
+ * final iteration is redone in double precision from the last float scores, so the result
+ * has the precision of csr_rank after the same number of iterations.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param refine, whether to do the final iteration in double precision
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_rank_float(struct csr* graph, int ncores, double dampener, int refine, double* scores) {
+	int npages = graph->npages;
+	float* buffers[2] = { memory_malloc(MEMORY_SCORES, sizeof(float) * npages), memory_malloc(MEMORY_SCORES, sizeof(float) * npages) };
+	float* contributions = memory_malloc(MEMORY_SCRATCH, sizeof(float) * npages);
+	float* inv_outlinks = memory_malloc(MEMORY_SCRATCH, sizeof(float) * npages);
+	if (buffers[0] == NULL || buffers[1] == NULL || contributions == NULL || inv_outlinks == NULL) {
+		memory_free(MEMORY_SCORES, buffers[0]);
+		memory_free(MEMORY_SCORES, buffers[1]);
+		memory_free(MEMORY_SCRATCH, contributions);
+		memory_free(MEMORY_SCRATCH, inv_outlinks);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	float dampening_value = (float)((1.0 - dampener) / ((double)npages));
+	float dampening = (float)dampener;
+	float initial_value = (float)(1 / (double)npages);
+
+	#pragma omp parallel for
+	for (int i = 0; i < npages; i++) {
+		buffers[0][i] = initial_value;
+		buffers[1][i] = initial_value;
+		inv_outlinks[i] = (float)graph->inv_outlinks[i];
+	}
+
+	int x = 1;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+		const float* old_scores = buffers[!x];
+		float* new_scores = buffers[x];
+
+		#pragma omp parallel
+		{
+			#pragma omp for simd
+			for (int i = 0; i < npages; i++) {
+				contributions[i] = old_scores[i] * inv_outlinks[i];
+			}
+
+			#pragma omp for reduction(+:diff)
+			for (int i = 0; i < npages; i++) {
+				float total = 0.0f;
+				for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+					total += contributions[graph->sources[e]];
+				}
+				new_scores[i] = dampening_value + total * dampening;
+				double change = (double)new_scores[i] - (double)old_scores[i];
+				diff += change * change;
+			}
+		}
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+	}
+
+	if (refine) {
+		// Redo the last iteration in double precision from the scores it started with
+		const float* old_scores = buffers[x];
+		double double_dampening_value = (1.0 - dampener) / ((double)npages);
+
+		#pragma omp parallel for
+		for (int i = 0; i < npages; i++) {
+			double total = 0.0;
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int src = graph->sources[e];
+				total += (double)old_scores[src] * graph->inv_outlinks[src];
+			}
+			scores[i] = double_dampening_value + total * dampener;
+		}
+	} else {
+		for (int i = 0; i < npages; i++) {
+			scores[i] = buffers[!x][i];
+		}
+	}
+
+	memory_free(MEMORY_SCORES, buffers[0]);
+	memory_free(MEMORY_SCORES, buffers[1]);
+	memory_free(MEMORY_SCRATCH, contributions);
+	memory_free(MEMORY_SCRATCH, inv_outlinks);
+	return 0;
+}
+
+
+/**
+ * Inlinks of a csr with each page's sources sorted and stored as delta encoded varints
+ * The first source of a page is stored as is and every other as the gap from the one before,
+ * 7 bits per byte with the high bit set on all but the last byte, so most inlinks of a
+ * well ordered graph take one byte rather than four.
+ */
+struct csr_compressed {
+	int npages;
+	size_t* offsets;	// varints of page i are bytes[offsets[i]] .. bytes[offsets[i + 1] - 1]
+	unsigned char* bytes;
+};
+
+
+/**
+ * Clean up an allocated compressed csr
+ * @param compressed, the compressed csr to free
+ */
+void csr_compressed_destroy(struct csr_compressed* compressed) {
+	if (compressed == NULL) {
+		return;
+	}
+	memory_free(MEMORY_EDGES, compressed->offsets);
+	memory_free(MEMORY_EDGES, compressed->bytes);
+	memory_free(MEMORY_EDGES, compressed);
+}
+
+
+/**
+ * Compare ints for qsort
+ */
+static int compare_ints(const void* a, const void* b) {
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Encode the sorted sources of a page as delta varints
+ * @param sources, the sorted sources
+ * @param count, the number of sources
+ * @param bytes, filled with the varints, or NULL to only count them
+ * @return the number of bytes of the varints
+ */
+static size_t varint_encode(const int* sources, int count, unsigned char* bytes) {
+	size_t size = 0;
+	int previous = 0;
+	for (int e = 0; e < count; e++) {
+		unsigned int gap = (unsigned int)(sources[e] - previous);
+		previous = sources[e];
+		while (gap >= 0x80) {
+			if (bytes != NULL) {
+				bytes[size] = (unsigned char)(gap | 0x80);
+			}
+			size++;
+			gap >>= 7;
+		}
+		if (bytes != NULL) {
+			bytes[size] = (unsigned char)gap;
+		}
+		size++;
+	}
+	return size;
+}
+
+
+/**
+ * Copy the inlinks of a page into a scratch array and sort them
+ * @param graph, the csr
+ * @param i, the page
+ * @param sorted, the scratch array, grown to fit
+ * @param capacity, the length of the scratch array
+ * @return the number of inlinks, or -1 if an allocation fails
+ */
+static int csr_sort_inlinks(const struct csr* graph, int i, int** sorted, int* capacity) {
+	int count = graph->offsets[i + 1] - graph->offsets[i];
+	if (count > *capacity) {
+		int* grown = memory_realloc(MEMORY_SCRATCH, *sorted, sizeof(int) * count);
+		if (grown == NULL) {
+			return -1;
+		}
+		*sorted = grown;
+		*capacity = count;
+	}
+	memcpy(*sorted, &graph->sources[graph->offsets[i]], sizeof(int) * count);
+	qsort(*sorted, count, sizeof(int), compare_ints);
+	return count;
+}
+
+
+/**
+ * Compress the inlinks of a csr
+ * A first pass sorts the inlinks of each page to count the bytes of their varints, so the
+ * second can sort them again and encode them straight into a buffer of the final size. When
+ * the csr is ranked_once the varints are written over its sources in page order instead, which
+ * is safe as long as no page's varints end past its own sources, and the sources are taken over.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @return the compressed inlinks, or NULL if an allocation fails
+ */
+struct csr_compressed* csr_compressed_create(struct csr* graph, int ncores) {
+	int npages = graph->npages;
+	struct csr_compressed* compressed = memory_calloc(MEMORY_EDGES, 1, sizeof(struct csr_compressed));
+	if (compressed == NULL || (compressed->offsets = memory_malloc(MEMORY_EDGES, sizeof(size_t) * (npages + 1))) == NULL) {
+		csr_compressed_destroy(compressed);
+		return NULL;
+	}
+	compressed->npages = npages;
+	compressed->offsets[0] = 0;
+
+	int failed = 0;
+	#pragma omp parallel num_threads(ncores) reduction(||:failed)
+	{
+		int* sorted = NULL;
+		int capacity = 0;
+		#pragma omp for schedule(dynamic, 64)
+		for (int i = 0; i < npages; i++) {
+			int count = failed ? -1 : csr_sort_inlinks(graph, i, &sorted, &capacity);
+			failed = count < 0;
+			compressed->offsets[i + 1] = count > 0 ? varint_encode(sorted, count, NULL) : 0;
+		}
+		memory_free(MEMORY_SCRATCH, sorted);
+	}
+
+	// The sizes of the pages become their offsets
+	int in_place = graph->ranked_once;
+	for (int i = 0; i < npages && !failed; i++) {
+		compressed->offsets[i + 1] += compressed->offsets[i];
+		in_place = in_place && compressed->offsets[i + 1] <= sizeof(int) * (size_t)graph->offsets[i + 1];
+	}
+
+	if (!failed && in_place) {
+		// Each page's sources are copied out before its varints overwrite them
+		int* sorted = NULL;
+		int capacity = 0;
+		unsigned char* bytes = (unsigned char*)graph->sources;
+		for (int i = 0; i < npages && !failed; i++) {
+			int count = csr_sort_inlinks(graph, i, &sorted, &capacity);
+			failed = count < 0;
+			if (count > 0) {
+				varint_encode(sorted, count, &bytes[compressed->offsets[i]]);
+			}
+		}
+		memory_free(MEMORY_SCRATCH, sorted);
+
+		// The sources are garbled either way
+		graph->sources = NULL;
+		compressed->bytes = memory_realloc(MEMORY_EDGES, bytes, compressed->offsets[npages] + 1);
+		if (compressed->bytes == NULL) {
+			compressed->bytes = bytes;
+		}
+	} else if (!failed && (compressed->bytes = memory_malloc(MEMORY_EDGES, compressed->offsets[npages] + 1)) == NULL) {
+		failed = 1;
+	} else if (!failed) {
+		#pragma omp parallel num_threads(ncores) reduction(||:failed)
+		{
+			int* sorted = NULL;
+			int capacity = 0;
+			#pragma omp for schedule(dynamic, 64)
+			for (int i = 0; i < npages; i++) {
+				int count = failed ? -1 : csr_sort_inlinks(graph, i, &sorted, &capacity);
+				failed = count < 0;
+				if (count > 0) {
+					varint_encode(sorted, count, &compressed->bytes[compressed->offsets[i]]);
+				}
+			}
+			memory_free(MEMORY_SCRATCH, sorted);
+		}
+	}
+	if (failed) {
+		csr_compressed_destroy(compressed);
+		return NULL;
+	}
+	return compressed;
+}
+
+
+/**
+ * Rank compressed inlinks by pulling over them, decoding each page's sources as it goes
+ * @param graph, the csr the inlinks were compressed from
+ * @param compressed, the compressed inlinks
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_compressed_rank(struct csr* graph, struct csr_compressed* compressed, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	if (buffers[1] == NULL) {
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		#pragma omp parallel for reduction(+:diff)
+		for (int i = 0; i < npages; i++) {
+			const unsigned char* cursor = &compressed->bytes[compressed->offsets[i]];
+			const unsigned char* end = &compressed->bytes[compressed->offsets[i + 1]];
+			unsigned int src = 0;
+			double total = 0.0;
+
+			while (cursor < end) {
+				// Single byte gaps are the common case
+				unsigned int gap = *cursor++;
+				if (gap & 0x80) {
+					gap &= 0x7F;
+					int shift = 7;
+					unsigned int byte;
+					do {
+						byte = *cursor++;
+						gap |= (byte & 0x7F) << shift;
+						shift += 7;
+					} while (byte & 0x80);
+				}
+				src += gap;
+				total += old_scores[src] * graph->inv_outlinks[src];
+			}
+			new_scores[i] = dampening_value + total * dampener;
+			diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+		}
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+	}
+
+	if (buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	memory_free(MEMORY_SCORES, buffers[1]);
+	return 0;
+}
+
+
+/**
+ * Inlinks of a csr split into blocks by source page
+ * Within a block the inlinks are grouped into entries, one per destination page with at least
+ * one inlink from that block, so a block can be processed with all of its random reads
+ * landing in one contiguous slice of source pages.
+ */
+struct csr_blocks {
+	int nblocks;
+	int block_size;		// source pages per block
+	int* block_entries;	// entries of block b are block_entries[b] .. block_entries[b + 1] - 1
+	int* entry_dsts;	// destination page of each entry
+	int* entry_edges;	// sources of entry e are sources[entry_edges[e]] .. sources[entry_edges[e + 1] - 1]
+	int* sources;		// source page of each inlink, grouped by block then entry
+};
+
+
+/**
+ * Clean up allocated csr blocks
+ * @param blocks, the blocks to free
+ */
+void csr_blocks_destroy(struct csr_blocks* blocks) {
+	if (blocks == NULL) {
+		return;
+	}
+	memory_free(MEMORY_EDGES, blocks->block_entries);
+	memory_free(MEMORY_EDGES, blocks->entry_dsts);
+	memory_free(MEMORY_EDGES, blocks->entry_edges);
+	memory_free(MEMORY_EDGES, blocks->sources);
+	memory_free(MEMORY_EDGES, blocks);
+}
+
+
+/**
+ * Clean up partially built csr blocks and their scratch arrays
+ * @return NULL, for returning from csr_blocks_create
+ */
+static struct csr_blocks* csr_blocks_abort(struct csr_blocks* blocks, int* last_dst, int* current) {
+	memory_free(MEMORY_SCRATCH, last_dst);
+	memory_free(MEMORY_SCRATCH, current);
+	csr_blocks_destroy(blocks);
+	return NULL;
+}
+
+
+/**
+ * Split the inlinks of a csr into blocks of block_size source pages
+ * @param graph, the csr
+ * @param block_size, the number of source pages per block
+ * @return the blocks, or NULL if an allocation fails
+ */
+struct csr_blocks* csr_blocks_create(struct csr* graph, int block_size) {
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	int nblocks = (npages + block_size - 1) / block_size;
+
+	struct csr_blocks* blocks = memory_calloc(MEMORY_EDGES, 1, sizeof(struct csr_blocks));
+	int* last_dst = memory_malloc(MEMORY_SCRATCH, sizeof(int) * nblocks);	// last destination that opened an entry in each block
+	int* current = memory_malloc(MEMORY_SCRATCH, sizeof(int) * nblocks);	// entry or edge being filled in each block
+	if (blocks == NULL || last_dst == NULL || current == NULL) {
+		return csr_blocks_abort(blocks, last_dst, current);
+	}
+	blocks->nblocks = nblocks;
+	blocks->block_size = block_size;
+
+	// Count the entries of each block
+	blocks->block_entries = memory_calloc(MEMORY_EDGES, nblocks + 1, sizeof(int));
+	if (blocks->block_entries == NULL) {
+		return csr_blocks_abort(blocks, last_dst, current);
+	}
+	for (int b = 0; b < nblocks; b++) {
+		last_dst[b] = -1;
+	}
+	for (int i = 0; i < npages; i++) {
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int b = graph->sources[e] / block_size;
+			if (last_dst[b] != i) {
+				last_dst[b] = i;
+				blocks->block_entries[b + 1]++;
+			}
+		}
+	}
+	for (int b = 0; b < nblocks; b++) {
+		blocks->block_entries[b + 1] += blocks->block_entries[b];
+	}
+
+	// Assign every entry its destination and count its inlinks
+	int nentries = blocks->block_entries[nblocks];
+	blocks->entry_dsts = memory_malloc(MEMORY_EDGES, sizeof(int) * (nentries > 0 ? nentries : 1));
+	blocks->entry_edges = memory_calloc(MEMORY_EDGES, nentries + 1, sizeof(int));
+	blocks->sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (nedges > 0 ? nedges : 1));
+	if (blocks->entry_dsts == NULL || blocks->entry_edges == NULL || blocks->sources == NULL) {
+		return csr_blocks_abort(blocks, last_dst, current);
+	}
+	for (int b = 0; b < nblocks; b++) {
+		last_dst[b] = -1;
+		current[b] = blocks->block_entries[b] - 1;
+	}
+	for (int i = 0; i < npages; i++) {
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int b = graph->sources[e] / block_size;
+			if (last_dst[b] != i) {
+				last_dst[b] = i;
+				blocks->entry_dsts[++current[b]] = i;
+			}
+			blocks->entry_edges[current[b] + 1]++;
+		}
+	}
+	for (int entry = 0; entry < nentries; entry++) {
+		blocks->entry_edges[entry + 1] += blocks->entry_edges[entry];
+	}
+
+	// Scatter the sources into their entries, entries of a destination are opened in the same order
+	int* fill = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (nentries > 0 ? nentries : 1));
+	if (fill == NULL) {
+		return csr_blocks_abort(blocks, last_dst, current);
+	}
+	memcpy(fill, blocks->entry_edges, sizeof(int) * nentries);
+	for (int b = 0; b < nblocks; b++) {
+		last_dst[b] = -1;
+		current[b] = blocks->block_entries[b] - 1;
+	}
+	for (int i = 0; i < npages; i++) {
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int src = graph->sources[e];
+			int b = src / block_size;
+			if (last_dst[b] != i) {
+				last_dst[b] = i;
+				current[b]++;
+			}
+			blocks->sources[fill[current[b]]++] = src;
+		}
+	}
+
+	memory_free(MEMORY_SCRATCH, fill);
+	memory_free(MEMORY_SCRATCH, last_dst);
+	memory_free(MEMORY_SCRATCH, current);
+	return blocks;
+}
+
+
+/* bytes of cache the blocked kernel sizes its blocks for, 0 reads the last level cache size */
+static long block_cache_bytes = 0;
+
+
+/**
+ * Work out how many source pages fit in a block
+ * Half of the cache is left for the streamed entries and destination sums.
+ * @return the number of source pages per block
+ */
+static int block_pages(void) {
+	long bytes = block_cache_bytes;
+	if (bytes <= 0) {
+		bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+	}
+	if (bytes <= 0) {
+		bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	}
+	if (bytes <= 0) {
+		bytes = 8L * 1024 * 1024;
+	}
+	long pages = bytes / 2 / (long)sizeof(double);
+	return pages < 1024 ? 1024 : (pages > INT_MAX ? INT_MAX : (int)pages);
+}
+
+
+/**
+ * Rank csr blocks one block at a time
+ * Each iteration first streams the contribution (score / noutlinks) of every page into an
+ * array, then for each block sums the inlinks of its entries, so the random reads of a block
+ * stay inside its cache sized slice of the contributions.
+ * @param graph, the csr
+ * @param blocks, the inlinks of the csr split into blocks
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_blocks_rank(struct csr* graph, struct csr_blocks* blocks, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	double* contributions = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages);
+	double* sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages);
+	if (contributions == NULL || sums == NULL) {
+		memory_free(MEMORY_SCRATCH, contributions);
+		memory_free(MEMORY_SCRATCH, sums);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+
+		#pragma omp parallel
+		{
+			#pragma omp for
+			for (int i = 0; i < npages; i++) {
+				contributions[i] = scores[i] * graph->inv_outlinks[i];
+				sums[i] = 0.0;
+			}
+
+			// Each destination has at most one entry per block so a block needs no atomics
+			for (int b = 0; b < blocks->nblocks; b++) {
+				#pragma omp for schedule(static)
+				for (int entry = blocks->block_entries[b]; entry < blocks->block_entries[b + 1]; entry++) {
+					double total = 0.0;
+					for (int e = blocks->entry_edges[entry]; e < blocks->entry_edges[entry + 1]; e++) {
+						total += contributions[blocks->sources[e]];
+					}
+					sums[blocks->entry_dsts[entry]] += total;
+				}
+			}
+
+			#pragma omp for reduction(+:diff)
+			for (int i = 0; i < npages; i++) {
+				double score = dampening_value + sums[i] * dampener;
+				diff += (score - scores[i]) * (score - scores[i]);
+				scores[i] = score;
+			}
+		}
+		diff = sqrt(diff);
+	}
+
+	memory_free(MEMORY_SCRATCH, contributions);
+	memory_free(MEMORY_SCRATCH, sums);
+	return 0;
+}
+
+
+/**
+ * Rank a csr with each thread sweeping its own edge balanced part
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param split_hubs, whether pages may be split across threads
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_balanced_rank(struct csr* graph, int ncores, double dampener, int split_hubs, double* scores) {
+	int npages = graph->npages;
+	struct csr_partition* partition = csr_partition_create(graph, ncores, split_hubs);
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	int* split_pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * 2 * ncores);
+	double* split_sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * ncores);
+	if (partition == NULL || buffers[1] == NULL || split_pages == NULL || split_sums == NULL) {
+		csr_partition_destroy(partition);
+		memory_free(MEMORY_SCORES, buffers[1]);
+		memory_free(MEMORY_SCRATCH, split_pages);
+		memory_free(MEMORY_SCRATCH, split_sums);
+		return -1;
+	}
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		#pragma omp parallel num_threads(ncores) reduction(+:diff)
+		for (int t = omp_get_thread_num(); t < ncores; t += omp_get_num_threads()) {
+			diff += csr_partition_sweep(graph, partition, t, old_scores, new_scores,
+					dampening_value, dampener, split_pages, split_sums);
+		}
+
+		diff += csr_partition_reduce(ncores, split_pages, split_sums, old_scores, new_scores,
+				dampening_value, dampener);
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+	}
+
+	if (buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	csr_partition_destroy(partition);
+	memory_free(MEMORY_SCORES, buffers[1]);
+	memory_free(MEMORY_SCRATCH, split_pages);
+	memory_free(MEMORY_SCRATCH, split_sums);
+	return 0;
+}
+
+
+/**
+ * State shared by the pthread workers of csr_steal_rank
+ */
+struct steal_rank {
+	struct csr* graph;
+	struct csr_partition* partition;
+	struct ws_pool* pool;
+	double* buffers[2];
+	int x;				// buffer being written this iteration
+	double dampening_value;
+	double dampener;
+	double* diffs;			// sum of squared changes found by each worker
+	int* split_pages;
+	double* split_sums;
+	pthread_barrier_t barrier;
+	pthread_mutex_t gate;		// held workers until the whole team has been created
+	pthread_cond_t gate_opened;
+	int open;
+	int done;
+};
+
+
+/**
+ * A pthread worker of csr_steal_rank
+ */
+struct steal_worker {
+	struct steal_rank* rank;
+	int id;
+	pthread_t thread;
+};
+
+
+/**
+ * Sweep iterations as one worker until the scores converge
+ * Each iteration the worker takes tasks (edge balanced page ranges) from its own deque and
+ * then steals from the others; the last worker to reach the barrier reduces the split pages
+ * and the differences, checks convergence and refills the deques for the next iteration.
+ * @param arg, the steal_worker
+ * @return NULL
+ */
+static void* steal_worker_run(void* arg) {
+	struct steal_worker* worker = arg;
+	struct steal_rank* rank = worker->rank;
+
+	pthread_mutex_lock(&rank->gate);
+	while (!rank->open) {
+		pthread_cond_wait(&rank->gate_opened, &rank->gate);
+	}
+	pthread_mutex_unlock(&rank->gate);
+
+	while (!rank->done) {
+		const double* old_scores = rank->buffers[!rank->x];
+		double* new_scores = rank->buffers[rank->x];
+		double diff = 0.0;
+
+		int task;
+		while ((task = ws_next(rank->pool, worker->id)) >= 0) {
+			diff += csr_partition_sweep(rank->graph, rank->partition, task, old_scores, new_scores,
+					rank->dampening_value, rank->dampener, rank->split_pages, rank->split_sums);
+		}
+		rank->diffs[worker->id] = diff;
+
+		if (pthread_barrier_wait(&rank->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+			diff = csr_partition_reduce(rank->partition->nparts, rank->split_pages, rank->split_sums,
+					old_scores, new_scores, rank->dampening_value, rank->dampener);
+			for (int w = 0; w < rank->pool->nworkers; w++) {
+				diff += rank->diffs[w];
+			}
+			rank->x = !rank->x;	// Update the value so we do not have to copy
+			rank->done = sqrt(diff) <= EPSILON;
+			ws_pool_reset(rank->pool);
+		}
+		pthread_barrier_wait(&rank->barrier);
+	}
+	return NULL;
+}
+
+
+/**
+ * Rank a csr with a team of pthreads sharing edge balanced page ranges by work stealing
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation or thread creation fails
+ */
+static int csr_steal_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	int ntasks = ncores * TASKS_PER_THREAD;
+	struct steal_rank rank = {
+		.graph = graph,
+		.partition = csr_partition_create(graph, ntasks, 1),
+		.pool = ws_pool_create(ncores, ntasks),
+		.buffers = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) },
+		.x = 1,
+		.dampening_value = (1.0 - dampener) / ((double)npages),
+		.dampener = dampener,
+		.diffs = memory_malloc(MEMORY_SCRATCH, sizeof(double) * ncores),
+		.split_pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * 2 * ntasks),
+		.split_sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * 2 * ntasks),
+		.gate = PTHREAD_MUTEX_INITIALIZER,
+		.gate_opened = PTHREAD_COND_INITIALIZER,
+		.open = 0,
+		.done = 0,
+	};
+	struct steal_worker* workers = memory_malloc(MEMORY_SCRATCH, sizeof(struct steal_worker) * ncores);
+	int failed = rank.partition == NULL || rank.pool == NULL || rank.buffers[1] == NULL
+		|| rank.diffs == NULL || rank.split_pages == NULL || rank.split_sums == NULL || workers == NULL;
+
+	if (!failed) {
+		double initial_value = 1 / (double)npages;
+		for (int i = 0; i < npages; i++) {
+			scores[i] = initial_value;
+		}
+
+		// The calling thread is worker 0
+		pthread_barrier_init(&rank.barrier, NULL, ncores);
+		int started = 1;
+		for (; started < ncores; started++) {
+			workers[started].rank = &rank;
+			workers[started].id = started;
+			if (pthread_create(&workers[started].thread, NULL, steal_worker_run, &workers[started]) != 0) {
+				break;
+			}
+		}
+
+		// A partial team would never get through the barrier so it is let go straight away
+		pthread_mutex_lock(&rank.gate);
+		failed = started < ncores;
+		rank.done = failed;
+		rank.open = 1;
+		pthread_cond_broadcast(&rank.gate_opened);
+		pthread_mutex_unlock(&rank.gate);
+
+		if (!failed) {
+			workers[0].rank = &rank;
+			workers[0].id = 0;
+			steal_worker_run(&workers[0]);
+		}
+		for (int w = 1; w < started; w++) {
+			pthread_join(workers[w].thread, NULL);
+		}
+		pthread_barrier_destroy(&rank.barrier);
+		pthread_mutex_destroy(&rank.gate);
+		pthread_cond_destroy(&rank.gate_opened);
+
+		if (!failed && rank.buffers[!rank.x] != scores) {
+			memcpy(scores, rank.buffers[!rank.x], sizeof(double) * npages);
+		}
+	}
+
+	csr_partition_destroy(rank.partition);
+	ws_pool_destroy(rank.pool);
+	memory_free(MEMORY_SCORES, rank.buffers[1]);
+	memory_free(MEMORY_SCRATCH, rank.diffs);
+	memory_free(MEMORY_SCRATCH, rank.split_pages);
+	memory_free(MEMORY_SCRATCH, rank.split_sums);
+	memory_free(MEMORY_SCRATCH, workers);
+	return failed ? -1 : 0;
+}
+
+
+#define EXTRAPOLATE_AITKEN 0
+#define EXTRAPOLATE_QUADRATIC 1
+
+/* iterations of the power method between extrapolations */
+#define EXTRAPOLATE_PERIOD 10
+
+
+
+/**
+ * Aitken delta squared extrapolation of the last three score vectors
+ * The ratio r of the last two changes is fitted by least squares over every page, then the
+ * scores jump to the limit of the geometric series the changes would follow, x + change * r / (1 - r).
+ * @param npages, the number of pages
+ * @param history, the last three score vectors, oldest first
+ * @param extrapolated, filled with the extrapolated scores
+ * @return 0 on success, otherwise -1 if the changes are not shrinking geometrically
+ */
+static int extrapolate_aitken(int npages, double* const history[3], double* extrapolated) {
+	double products = 0.0;
+	double squares = 0.0;
+
+	#pragma omp parallel for reduction(+:products, squares)
+	for (int i = 0; i < npages; i++) {
+		double change = history[2][i] - history[1][i];
+		double last_change = history[1][i] - history[0][i];
+		products += change * last_change;
+		squares += last_change * last_change;
+	}
+
+	double ratio = squares > 0.0 ? products / squares : -1.0;
+	if (ratio <= 0.0 || ratio >= 1.0) {
+		return -1;
+	}
+
+	double factor = ratio / (1.0 - ratio);
+	#pragma omp parallel for
+	for (int i = 0; i < npages; i++) {
+		extrapolated[i] = history[2][i] + (history[2][i] - history[1][i]) * factor;
+	}
+	return 0;
+}
+
+
+/**
+ * Quadratic extrapolation of the last four score vectors
+ * Assumes the error is made of the two slowest decaying eigenvectors of the iteration, so the
+ * scores satisfy a recurrence with coefficients of the polynomial (z - 1)(z - a)(z - b). Its
+ * coefficients are fitted by least squares to the changes from the oldest scores, then the
+ * factor (z - a)(z - b) applied to the newest three cancels both eigenvectors, leaving the limit.
+ * @param npages, the number of pages
+ * @param history, the last four score vectors, oldest first
+ * @param extrapolated, filled with the extrapolated scores
+ * @return 0 on success, otherwise -1 if the fit is degenerate
+ */
+static int extrapolate_quadratic(int npages, double* const history[4], double* extrapolated) {
+	// Normal equations of min |y1 g1 + y2 g2 + y3| with yj = history[j] - history[0]
+	double a11 = 0.0, a12 = 0.0, a22 = 0.0, b1 = 0.0, b2 = 0.0;
+
+	#pragma omp parallel for reduction(+:a11, a12, a22, b1, b2)
+	for (int i = 0; i < npages; i++) {
+		double y1 = history[1][i] - history[0][i];
+		double y2 = history[2][i] - history[0][i];
+		double y3 = history[3][i] - history[0][i];
+		a11 += y1 * y1;
+		a12 += y1 * y2;
+		a22 += y2 * y2;
+		b1 -= y1 * y3;
+		b2 -= y2 * y3;
+	}
+
+	double determinant = a11 * a22 - a12 * a12;
+	if (fabs(determinant) <= 1E-12 * a11 * a22) {
+		return -1;
+	}
+	double g1 = (b1 * a22 - b2 * a12) / determinant;
+	double g2 = (a11 * b2 - a12 * b1) / determinant;
+
+	// Divide out the (z - 1) factor, scaling by the value at 1 so a constant vector is kept
+	double beta0 = g1 + g2 + 1.0;
+	double beta1 = g2 + 1.0;
+	double beta2 = 1.0;
+	double scale = beta0 + beta1 + beta2;
+	if (fabs(scale) <= 1E-12) {
+		return -1;
+	}
+
+	#pragma omp parallel for
+	for (int i = 0; i < npages; i++) {
+		extrapolated[i] = (beta0 * history[1][i] + beta1 * history[2][i] + beta2 * history[3][i]) / scale;
+	}
+	return 0;
+}
+
+
+/**
+ * Rank a csr by pulling over the inlinks of every page, extrapolating the scores periodically
+ * Every EXTRAPOLATE_PERIOD iterations the scores are kept, and once three (aitken) or four
+ * (quadratic) have been kept since the last extrapolation the ranking carries on from an
+ * estimate of their limit. Aitken fits one real ratio, so it needs the slowest change to repeat
+ * every period, while quadratic also cancels the rotating pair of changes a cycle makes. A fit
+ * that fails or gives negative scores is skipped. The iterations and extrapolations are
+ * reported on stderr.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param method, EXTRAPOLATE_AITKEN or EXTRAPOLATE_QUADRATIC
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_extrapolated_rank(struct csr* graph, int ncores, double dampener, int method, double* scores) {
+	int npages = graph->npages;
+	double* history[4];	// scores kept every EXTRAPOLATE_PERIOD iterations, oldest first
+	double* next = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages);
+	int failed = next == NULL;
+	for (int k = 0; k < 4; k++) {
+		failed = (history[k] = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages)) == NULL || failed;
+	}
+	if (failed) {
+		for (int k = 0; k < 4; k++) {
+			memory_free(MEMORY_SCRATCH, history[k]);
+		}
+		memory_free(MEMORY_SCRATCH, next);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int needed = method == EXTRAPOLATE_AITKEN ? 3 : 4;
+	int kept = 0;
+	int iterations = 0;
+	int extrapolations = 0;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+
+		#pragma omp parallel for reduction(+:diff)
+		for (int i = 0; i < npages; i++) {
+			double total = 0.0;
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int src = graph->sources[e];
+				total += scores[src] * graph->inv_outlinks[src];
+			}
+			next[i] = dampening_value + total * dampener;
+			diff += (next[i] - scores[i]) * (next[i] - scores[i]);
+		}
+		iterations++;
+		diff = sqrt(diff);
+
+		memcpy(scores, next, sizeof(double) * npages);
+
+		if (iterations % EXTRAPOLATE_PERIOD != 0 || diff <= EPSILON) {
+			continue;
+		}
+
+		// Keep the scores, newest last, and extrapolate once enough are kept
+		double* oldest = history[0];
+		for (int k = 0; k < 3; k++) {
+			history[k] = history[k + 1];
+		}
+		history[3] = oldest;
+		memcpy(history[3], scores, sizeof(double) * npages);
+		if (++kept < needed) {
+			continue;
+		}
+
+		// Quadratic falls back to aitken when a single ratio is all the kept scores show
+		int extrapolated_ok = (method == EXTRAPOLATE_QUADRATIC && extrapolate_quadratic(npages, history, next) == 0)
+			|| extrapolate_aitken(npages, &history[1], next) == 0;
+
+		// Scores are never negative, so a fit that gives some is overshooting
+		for (int i = 0; i < npages && extrapolated_ok; i++) {
+			extrapolated_ok = next[i] >= 0.0;
+		}
+		if (extrapolated_ok) {
+			memcpy(scores, next, sizeof(double) * npages);
+			extrapolations++;
+			kept = 0;
+		}
+	}
+
+	fprintf(stderr, "iterations %d extrapolations %d\n", iterations, extrapolations);
+	for (int k = 0; k < 4; k++) {
+		memory_free(MEMORY_SCRATCH, history[k]);
+	}
+	memory_free(MEMORY_SCRATCH, next);
+	return 0;
+}
+
+
+/* most iterations a krylov solver runs before giving up on reaching EPSILON */
+#define KRYLOV_MAX_ITERATIONS 10000
+
+/* vectors kept by gmres before it restarts */
+#define GMRES_RESTART 30
+
+
+/**
+ * Multiply by the matrix of the pagerank linear system, y = (I - dM)x
+ * M has 1 / noutlinks[j] at (i, j) for every inlink j of page i, so (I - dM)x = b with
+ * b = (1 - d) / N at every page is solved by the scores the power method converges to.
+ * @param graph, the csr
+ * @param dampener, the dampening effect on the pages
+ * @param x, the vector to multiply
+ * @param y, filled with the product
+ */
+static void csr_system_multiply(const struct csr* graph, double dampener, const double* x, double* y) {
+	#pragma omp parallel for
+	for (int i = 0; i < graph->npages; i++) {
+		double total = 0.0;
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int src = graph->sources[e];
+			total += x[src] * graph->inv_outlinks[src];
+		}
+		y[i] = x[i] - total * dampener;
+	}
+}
+
+
+/**
+ * Dot product of two vectors
+ */
+static double vector_dot(int n, const double* x, const double* y) {
+	double total = 0.0;
+	#pragma omp parallel for reduction(+:total)
+	for (int i = 0; i < n; i++) {
+		total += x[i] * y[i];
+	}
+	return total;
+}
+
+
+/**
+ * Fill the jacobi preconditioner of the pagerank linear system, the inverse of its diagonal
+ * The diagonal is 1 less d / noutlinks for a page linking to itself, otherwise 1.
+ * @param graph, the csr
+ * @param dampener, the dampening effect on the pages
+ * @param inv_diagonal, filled with the inverse of each diagonal entry
+ */
+static void csr_system_jacobi(const struct csr* graph, double dampener, double* inv_diagonal) {
+	#pragma omp parallel for
+	for (int i = 0; i < graph->npages; i++) {
+		double diagonal = 1.0;
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			if (graph->sources[e] == i) {
+				diagonal -= dampener * graph->inv_outlinks[i];
+			}
+		}
+		inv_diagonal[i] = 1.0 / diagonal;
+	}
+}
+
+
+/**
+ * Rank a csr by solving (I - dM)x = b with jacobi preconditioned BiCGSTAB
+ * Stops once the residual |b - (I - dM)x| is at most EPSILON * (1 - d) / sqrt(npages), so the
+ * summed error of the scores is at most EPSILON, the inverse of (I - dM) being at most
+ * 1 / (1 - d) in that norm. The solver
+ * restarts from the current scores if it breaks down, or if the residual it updates as it goes
+ * has drifted from the true one when it looks converged. The matrix multiplications used are
+ * reported on stderr.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_bicgstab_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int n = graph->npages;
+	double* vectors[8];
+	int failed = 0;
+	for (int k = 0; k < 8; k++) {
+		failed = (vectors[k] = memory_malloc(MEMORY_SCRATCH, sizeof(double) * n)) == NULL || failed;
+	}
+	if (failed) {
+		for (int k = 0; k < 8; k++) {
+			memory_free(MEMORY_SCRATCH, vectors[k]);
+		}
+		return -1;
+	}
+	double* x = scores;
+	double* r = vectors[0];
+	double* r_hat = vectors[1];
+	double* p = vectors[2];
+	double* v = vectors[3];
+	double* y = vectors[4];	// preconditioned p, then preconditioned s
+	double* s = vectors[5];
+	double* t = vectors[6];
+	double* inv_diagonal = vectors[7];
+	omp_set_num_threads(ncores);
+
+	double b = (1.0 - dampener) / ((double)n);
+	double tolerance = EPSILON * (1.0 - dampener) / sqrt((double)n);
+	csr_system_jacobi(graph, dampener, inv_diagonal);
+	for (int i = 0; i < n; i++) {
+		x[i] = 1 / (double)n;
+	}
+
+	int multiplies = 0;
+	int restart = 1;
+	double rho = 1.0, alpha = 1.0, omega = 1.0;
+	double residual = 1;
+
+	for (int iteration = 0; iteration < KRYLOV_MAX_ITERATIONS; iteration++) {
+		if (restart) {
+			// Start again from the residual of the current scores
+			csr_system_multiply(graph, dampener, x, r);
+			multiplies++;
+			#pragma omp parallel for
+			for (int i = 0; i < n; i++) {
+				r[i] = b - r[i];
+				r_hat[i] = r[i];
+				p[i] = 0.0;
+				v[i] = 0.0;
+			}
+			rho = alpha = omega = 1.0;
+			restart = 0;
+			if ((residual = sqrt(vector_dot(n, r, r))) <= tolerance) {
+				break;
+			}
+		}
+
+		double rho_next = vector_dot(n, r_hat, r);
+		if (rho_next == 0.0 || omega == 0.0) {
+			restart = 1;
+			continue;
+		}
+		double beta = (rho_next / rho) * (alpha / omega);
+		rho = rho_next;
+
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			p[i] = r[i] + beta * (p[i] - omega * v[i]);
+			y[i] = p[i] * inv_diagonal[i];
+		}
+		csr_system_multiply(graph, dampener, y, v);
+		multiplies++;
+
+		double r_hat_v = vector_dot(n, r_hat, v);
+		if (r_hat_v == 0.0) {
+			restart = 1;
+			continue;
+		}
+		alpha = rho / r_hat_v;
+
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			x[i] += alpha * y[i];
+			s[i] = r[i] - alpha * v[i];
+		}
+		if ((residual = sqrt(vector_dot(n, s, s))) <= tolerance) {
+			restart = 1;	// check the true residual
+			continue;
+		}
+
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			y[i] = s[i] * inv_diagonal[i];
+		}
+		csr_system_multiply(graph, dampener, y, t);
+		multiplies++;
+
+		double t_t = vector_dot(n, t, t);
+		omega = t_t > 0.0 ? vector_dot(n, t, s) / t_t : 0.0;
+
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			x[i] += omega * y[i];
+			r[i] = s[i] - omega * t[i];
+		}
+		if ((residual = sqrt(vector_dot(n, r, r))) <= tolerance) {
+			restart = 1;
+		}
+	}
+
+	fprintf(stderr, "multiplies %d residual %g\n", multiplies, residual);
+	for (int k = 0; k < 8; k++) {
+		memory_free(MEMORY_SCRATCH, vectors[k]);
+	}
+	return 0;
+}
+
+
+/**
+ * Rank a csr by solving (I - dM)x = b with jacobi preconditioned GMRES, restarted every
+ * GMRES_RESTART iterations
+ * Each restart builds an orthonormal basis of the krylov space of the residual with modified
+ * Gram-Schmidt, keeping the least squares residual up to date with Givens rotations, and stops
+ * once the true residual at a restart is at most EPSILON * (1 - d) / sqrt(npages), bounding
+ * the error by EPSILON as for the bicgstab kernel. The matrix
+ * multiplications used are reported on stderr.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_gmres_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int n = graph->npages;
+	int m = GMRES_RESTART;
+	double* basis[GMRES_RESTART + 1];
+	double* w = memory_malloc(MEMORY_SCRATCH, sizeof(double) * n);
+	double* inv_diagonal = memory_malloc(MEMORY_SCRATCH, sizeof(double) * n);
+	double* hessenberg = memory_calloc(MEMORY_SCRATCH, (size_t)(m + 1) * m, sizeof(double));	// column j at [j * (m + 1)]
+	double cosines[GMRES_RESTART];
+	double sines[GMRES_RESTART];
+	double g[GMRES_RESTART + 1];
+	double y[GMRES_RESTART];
+	int failed = w == NULL || inv_diagonal == NULL || hessenberg == NULL;
+	for (int k = 0; k <= m; k++) {
+		failed = (basis[k] = memory_malloc(MEMORY_SCRATCH, sizeof(double) * n)) == NULL || failed;
+	}
+	if (failed) {
+		for (int k = 0; k <= m; k++) {
+			memory_free(MEMORY_SCRATCH, basis[k]);
+		}
+		memory_free(MEMORY_SCRATCH, w);
+		memory_free(MEMORY_SCRATCH, inv_diagonal);
+		memory_free(MEMORY_SCRATCH, hessenberg);
+		return -1;
+	}
+	double* x = scores;
+	omp_set_num_threads(ncores);
+
+	double b = (1.0 - dampener) / ((double)n);
+	double tolerance = EPSILON * (1.0 - dampener) / sqrt((double)n);
+	csr_system_jacobi(graph, dampener, inv_diagonal);
+	for (int i = 0; i < n; i++) {
+		x[i] = 1 / (double)n;
+	}
+
+	int multiplies = 0;
+	int iterations = 0;
+	double residual = 1;
+
+	while (iterations < KRYLOV_MAX_ITERATIONS) {
+		// Residual of the current scores starts the basis
+		csr_system_multiply(graph, dampener, x, basis[0]);
+		multiplies++;
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			basis[0][i] = b - basis[0][i];
+		}
+		if ((residual = sqrt(vector_dot(n, basis[0], basis[0]))) <= tolerance) {
+			break;
+		}
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			basis[0][i] /= residual;
+		}
+		g[0] = residual;
+
+		int j = 0;
+		for (; j < m && iterations < KRYLOV_MAX_ITERATIONS; j++, iterations++) {
+			double* h = &hessenberg[(size_t)j * (m + 1)];
+
+			// w = A K^-1 v_j, made orthogonal to the basis so far
+			#pragma omp parallel for
+			for (int i = 0; i < n; i++) {
+				basis[j + 1][i] = basis[j][i] * inv_diagonal[i];
+			}
+			csr_system_multiply(graph, dampener, basis[j + 1], w);
+			multiplies++;
+			for (int k = 0; k <= j; k++) {
+				h[k] = vector_dot(n, w, basis[k]);
+				#pragma omp parallel for
+				for (int i = 0; i < n; i++) {
+					w[i] -= h[k] * basis[k][i];
+				}
+			}
+			h[j + 1] = sqrt(vector_dot(n, w, w));
+			if (h[j + 1] > 0.0) {
+				#pragma omp parallel for
+				for (int i = 0; i < n; i++) {
+					basis[j + 1][i] = w[i] / h[j + 1];
+				}
+			}
+
+			// Rotate the new column into upper triangular form
+			for (int k = 0; k < j; k++) {
+				double rotated = cosines[k] * h[k] + sines[k] * h[k + 1];
+				h[k + 1] = -sines[k] * h[k] + cosines[k] * h[k + 1];
+				h[k] = rotated;
+			}
+			double norm = sqrt(h[j] * h[j] + h[j + 1] * h[j + 1]);
+			cosines[j] = norm > 0.0 ? h[j] / norm : 1.0;
+			sines[j] = norm > 0.0 ? h[j + 1] / norm : 0.0;
+			h[j] = norm;
+			h[j + 1] = 0.0;
+			g[j + 1] = -sines[j] * g[j];
+			g[j] = cosines[j] * g[j];
+
+			residual = fabs(g[j + 1]);
+			if (residual <= tolerance || norm == 0.0) {
+				j++;
+				iterations++;
+				break;
+			}
+		}
+
+		// Solve the triangular system and move the scores along the basis
+		for (int k = j - 1; k >= 0; k--) {
+			double total = g[k];
+			for (int l = k + 1; l < j; l++) {
+				total -= hessenberg[(size_t)l * (m + 1) + k] * y[l];
+			}
+			double diagonal = hessenberg[(size_t)k * (m + 1) + k];
+			y[k] = diagonal != 0.0 ? total / diagonal : 0.0;
+		}
+		#pragma omp parallel for
+		for (int i = 0; i < n; i++) {
+			double step = 0.0;
+			for (int k = 0; k < j; k++) {
+				step += y[k] * basis[k][i];
+			}
+			x[i] += step * inv_diagonal[i];
+		}
+	}
+
+	fprintf(stderr, "multiplies %d residual %g\n", multiplies, residual);
+	for (int k = 0; k <= m; k++) {
+		memory_free(MEMORY_SCRATCH, basis[k]);
+	}
+	memory_free(MEMORY_SCRATCH, w);
+	memory_free(MEMORY_SCRATCH, inv_diagonal);
+	memory_free(MEMORY_SCRATCH, hessenberg);
+	return 0;
+}
+
+
+/* components with at least this many pages are iterated by every thread together */
+#define SCC_PARALLEL_PAGES 4096
+
+/* levels with fewer components than this are ranked by one thread, as a deep graph has many small levels */
+#define SCC_PARALLEL_COMPONENTS 64
+
+
+/**
+ * Strongly connected components of a csr in topological order, grouped into levels
+ * Every inlink of a page comes from its own component or one earlier in the order, and from a
+ * component in an earlier level unless it is its own, so the components of a level only depend
+ * on finished ones.
+ */
+struct csr_components {
+	int ncomponents;
+	int nlevels;
+	int* components;	// component of each page
+	int* offsets;		// pages of component c are pages[offsets[c]] .. pages[offsets[c + 1] - 1]
+	int* pages;
+	int* level_offsets;	// components of level l are by_level[level_offsets[l]] .. by_level[level_offsets[l + 1] - 1]
+	int* by_level;
+};
+
+
+/**
+ * Clean up allocated components
+ */
+void csr_components_destroy(struct csr_components* scc) {
+	if (scc == NULL) {
+		return;
+	}
+	memory_free(MEMORY_SCRATCH, scc->components);
+	memory_free(MEMORY_SCRATCH, scc->offsets);
+	memory_free(MEMORY_SCRATCH, scc->pages);
+	memory_free(MEMORY_SCRATCH, scc->level_offsets);
+	memory_free(MEMORY_SCRATCH, scc->by_level);
+	memory_free(MEMORY_SCRATCH, scc);
+}
+
+
+/**
+ * Find the strongly connected components of a csr with an iterative Tarjan's algorithm
+ * Tarjan's algorithm finishes a component only after every component it links to, so
+ * numbering them backwards gives a topological order along the links.
+ * @param graph, the csr with its outlinks built
+ * @param components, filled with the component of each page
+ * @return the number of components, or -1 if an allocation fails
+ */
+static int csr_tarjan(const struct csr* graph, int* components) {
+	int npages = graph->npages;
+	int* index = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	int* low = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	int* next_edge = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	int* calls = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);	// pages being visited, deepest last
+	int* stack = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);	// visited pages without a component yet
+	if (index == NULL || low == NULL || next_edge == NULL || calls == NULL || stack == NULL) {
+		memory_free(MEMORY_SCRATCH, index);
+		memory_free(MEMORY_SCRATCH, low);
+		memory_free(MEMORY_SCRATCH, next_edge);
+		memory_free(MEMORY_SCRATCH, calls);
+		memory_free(MEMORY_SCRATCH, stack);
+		return -1;
+	}
+	for (int i = 0; i < npages; i++) {
+		index[i] = -1;
+		components[i] = -1;
+	}
+
+	int visited = 0;
+	int ncomponents = 0;
+	int top = 0;
+	for (int root = 0; root < npages; root++) {
+		if (index[root] >= 0) {
+			continue;
+		}
+		int depth = 0;
+		calls[0] = root;
+		index[root] = low[root] = visited++;
+		next_edge[root] = graph->out_offsets[root];
+		stack[top++] = root;
+
+		while (depth >= 0) {
+			int v = calls[depth];
+			if (next_edge[v] < graph->out_offsets[v + 1]) {
+				int w = graph->targets[next_edge[v]++];
+				if (index[w] < 0) {
+					index[w] = low[w] = visited++;
+					next_edge[w] = graph->out_offsets[w];
+					stack[top++] = w;
+					calls[++depth] = w;
+				} else if (components[w] < 0 && index[w] < low[v]) {
+					// Still on the stack, so part of a component not finished yet
+					low[v] = index[w];
+				}
+				continue;
+			}
+
+			// Every link of v is done, so it is the root of a component if nothing reached above it
+			if (low[v] == index[v]) {
+				int w;
+				do {
+					w = stack[--top];
+					components[w] = ncomponents;
+				} while (w != v);
+				ncomponents++;
+			}
+			if (--depth >= 0 && low[v] < low[calls[depth]]) {
+				low[calls[depth]] = low[v];
+			}
+		}
+	}
+
+	// Number the components in the order the links go
+	for (int i = 0; i < npages; i++) {
+		components[i] = ncomponents - 1 - components[i];
+	}
+
+	memory_free(MEMORY_SCRATCH, index);
+	memory_free(MEMORY_SCRATCH, low);
+	memory_free(MEMORY_SCRATCH, next_edge);
+	memory_free(MEMORY_SCRATCH, calls);
+	memory_free(MEMORY_SCRATCH, stack);
+	return ncomponents;
+}
+
+
+/**
+ * Find the strongly connected components of a csr and group them into levels
+ * @param graph, the csr
+ * @return the components, or NULL if an allocation fails
+ */
+struct csr_components* csr_components_create(struct csr* graph) {
+	int npages = graph->npages;
+	struct csr_components* scc = memory_calloc(MEMORY_SCRATCH, 1, sizeof(struct csr_components));
+	if (scc == NULL) {
+		return NULL;
+	}
+	scc->components = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	scc->pages = memory_malloc(MEMORY_SCRATCH, sizeof(int) * npages);
+	if (scc->components == NULL || scc->pages == NULL || csr_build_outlinks(graph) != 0
+			|| (scc->ncomponents = csr_tarjan(graph, scc->components)) < 0) {
+		csr_components_destroy(scc);
+		return NULL;
+	}
+	int ncomponents = scc->ncomponents;
+	scc->offsets = memory_calloc(MEMORY_SCRATCH, ncomponents + 1, sizeof(int));
+	int* levels = memory_calloc(MEMORY_SCRATCH, ncomponents, sizeof(int));
+	scc->level_offsets = memory_calloc(MEMORY_SCRATCH, ncomponents + 1, sizeof(int));
+	scc->by_level = memory_malloc(MEMORY_SCRATCH, sizeof(int) * ncomponents);
+	if (scc->offsets == NULL || levels == NULL || scc->level_offsets == NULL || scc->by_level == NULL) {
+		memory_free(MEMORY_SCRATCH, levels);
+		csr_components_destroy(scc);
+		return NULL;
+	}
+
+	// Group the pages by component
+	for (int i = 0; i < npages; i++) {
+		scc->offsets[scc->components[i] + 1]++;
+	}
+	for (int c = 0; c < ncomponents; c++) {
+		scc->offsets[c + 1] += scc->offsets[c];
+	}
+	for (int i = 0; i < npages; i++) {
+		scc->pages[scc->offsets[scc->components[i]]++] = i;
+	}
+	for (int c = ncomponents; c > 0; c--) {
+		scc->offsets[c] = scc->offsets[c - 1];
+	}
+	scc->offsets[0] = 0;
+
+	// Each component is one level after the latest component linking to it
+	for (int c = 0; c < ncomponents; c++) {
+		for (int k = scc->offsets[c]; k < scc->offsets[c + 1]; k++) {
+			int i = scc->pages[k];
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int from = scc->components[graph->sources[e]];
+				if (from != c && levels[from] + 1 > levels[c]) {
+					levels[c] = levels[from] + 1;
+				}
+			}
+		}
+		if (levels[c] + 1 > scc->nlevels) {
+			scc->nlevels = levels[c] + 1;
+		}
+	}
+	for (int c = 0; c < ncomponents; c++) {
+		scc->level_offsets[levels[c] + 1]++;
+	}
+	for (int l = 0; l < scc->nlevels; l++) {
+		scc->level_offsets[l + 1] += scc->level_offsets[l];
+	}
+	for (int c = ncomponents - 1; c >= 0; c--) {
+		scc->by_level[--scc->level_offsets[levels[c] + 1]] = c;
+	}
+	// Filling from the back left each offset at the start of the next level
+	for (int l = 0; l < scc->nlevels; l++) {
+		scc->level_offsets[l] = scc->level_offsets[l + 1];
+	}
+	scc->level_offsets[scc->nlevels] = ncomponents;
+	memory_free(MEMORY_SCRATCH, levels);
+	return scc;
+}
+
+
+/**
+ * Rank the pages of one component, with every component linking to it already ranked
+ * A page on its own without a link to itself gets its final score in one pass, otherwise the
+ * component is iterated like the power method until its share of the convergence threshold
+ * (EPSILON squared times its share of the pages) is reached.
+ * @param graph, the csr
+ * @param scc, the components
+ * @param c, the component to rank
+ * @param dampener, the dampening effect on the pages
+ * @param parallel, whether to split the pages between the threads
+ * @param scores, the score of each page, filled for the pages of the component
+ * @param next, space for the next score of the pages of the component
+ * @return the number of iterations, 0 if it was ranked in one pass
+ */
+static int component_rank(const struct csr* graph, const struct csr_components* scc, int c, double dampener,
+		int parallel, double* scores, double* next) {
+	const int* pages = &scc->pages[scc->offsets[c]];
+	int count = scc->offsets[c + 1] - scc->offsets[c];
+	double dampening_value = (1.0 - dampener) / ((double)graph->npages);
+
+	if (count == 1) {
+		int i = pages[0];
+		int cyclic = 0;
+		double total = 0.0;
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			int src = graph->sources[e];
+			cyclic = cyclic || src == i;
+			total += scores[src] * graph->inv_outlinks[src];
+		}
+		if (!cyclic) {
+			scores[i] = dampening_value + total * dampener;
+			return 0;
+		}
+	}
+
+	double threshold = EPSILON * EPSILON * count / graph->npages;
+	double initial_value = 1 / (double)graph->npages;
+	for (int k = 0; k < count; k++) {
+		scores[pages[k]] = initial_value;
+	}
+
+	int iterations = 0;
+	double diff = threshold + 1;
+	while (diff > threshold) {
+		diff = 0.0;
+
+		#pragma omp parallel for if(parallel) reduction(+:diff)
+		for (int k = 0; k < count; k++) {
+			int i = pages[k];
+			double total = 0.0;
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int src = graph->sources[e];
+				total += scores[src] * graph->inv_outlinks[src];
+			}
+			next[i] = dampening_value + total * dampener;
+			diff += (next[i] - scores[i]) * (next[i] - scores[i]);
+		}
+
+		#pragma omp parallel for if(parallel)
+		for (int k = 0; k < count; k++) {
+			scores[pages[k]] = next[pages[k]];
+		}
+		iterations++;
+	}
+	return iterations;
+}
+
+
+/**
+ * Rank a csr one strongly connected component at a time in topological order
+ * Components only depend on the ones linking to them, so acyclic parts of the graph are
+ * ranked in a single pass and only the components with cycles are iterated, each with its
+ * inlinks from other components already final. The components of a level are shared between
+ * the threads, while large ones are iterated by every thread together. As each component
+ * converges to its share of EPSILON squared, the residual of the whole graph is still at most
+ * EPSILON. The components, cyclic components, largest component, levels and the most
+ * iterations of a component are reported on stderr.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_scc_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	struct csr_components* scc = csr_components_create(graph);
+	double* next = memory_malloc(MEMORY_SCORES, sizeof(double) * graph->npages);
+	if (scc == NULL || next == NULL) {
+		csr_components_destroy(scc);
+		memory_free(MEMORY_SCORES, next);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	int cyclic = 0;
+	int largest = 0;
+	int most_iterations = 0;
+	for (int l = 0; l < scc->nlevels; l++) {
+		int first = scc->level_offsets[l];
+		int last = scc->level_offsets[l + 1];
+
+		#pragma omp parallel for if(last - first >= SCC_PARALLEL_COMPONENTS) schedule(dynamic, 16) \
+				reduction(max:largest, most_iterations) reduction(+:cyclic)
+		for (int k = first; k < last; k++) {
+			int c = scc->by_level[k];
+			int count = scc->offsets[c + 1] - scc->offsets[c];
+			if (count < SCC_PARALLEL_PAGES) {
+				int iterations = component_rank(graph, scc, c, dampener, 0, scores, next);
+				cyclic += iterations > 0;
+				largest = count > largest ? count : largest;
+				most_iterations = iterations > most_iterations ? iterations : most_iterations;
+			}
+		}
+
+		for (int k = first; k < last; k++) {
+			int c = scc->by_level[k];
+			int count = scc->offsets[c + 1] - scc->offsets[c];
+			if (count >= SCC_PARALLEL_PAGES) {
+				int iterations = component_rank(graph, scc, c, dampener, 1, scores, next);
+				cyclic++;
+				largest = count > largest ? count : largest;
+				most_iterations = iterations > most_iterations ? iterations : most_iterations;
+			}
+		}
+	}
+
+	fprintf(stderr, "components %d cyclic %d largest %d levels %d iterations %d\n",
+			scc->ncomponents, cyclic, largest, scc->nlevels, most_iterations);
+	csr_components_destroy(scc);
+	memory_free(MEMORY_SCORES, next);
+	return 0;
+}
+
+
+/**
+ * One inlink as a flat pair of page indices
+ */
+struct edge {
+	int source;
+	int target;
+};
+
+
+/**
+ * The inlinks of a csr as a flat array of edges binned by target partition, for edge centric kernels
+ * A partition is a range of target pages small enough for its sums to stay in cache, and the
+ * edges of a partition are sorted by source so the contributions are read in order.
+ */
+struct csr_edges {
+	int nparts;
+	int part_pages;		// target pages per partition, the last may have fewer
+	int* offsets;		// edges of partition p are edges[offsets[p]] .. edges[offsets[p + 1] - 1]
+	struct edge* edges;
+};
+
+
+/**
+ * Clean up allocated csr edges
+ */
+void csr_edges_destroy(struct csr_edges* edges) {
+	if (edges == NULL) {
+		return;
+	}
+	memory_free(MEMORY_EDGES, edges->offsets);
+	memory_free(MEMORY_EDGES, edges->edges);
+	memory_free(MEMORY_EDGES, edges);
+}
+
+
+/**
+ * Order edges by source, then by target
+ */
+static int compare_edges(const void* a, const void* b) {
+	const struct edge* x = a;
+	const struct edge* y = b;
+	if (x->source != y->source) {
+		return x->source < y->source ? -1 : 1;
+	}
+	return x->target < y->target ? -1 : x->target > y->target;
+}
+
+
+/**
+ * Flatten the inlinks of a csr into edges binned by target partition
+ * The csr already groups inlinks by target in page order, so each partition is a slice of it
+ * which is then sorted by source.
+ * @param graph, the csr
+ * @param part_pages, the number of target pages per partition, at most the pages of the csr
+ * @return the edges, or NULL if an allocation fails
+ */
+struct csr_edges* csr_edges_create(struct csr* graph, int part_pages) {
+	int npages = graph->npages;
+	int nedges = graph->offsets[npages];
+	struct csr_edges* edges = memory_calloc(MEMORY_EDGES, 1, sizeof(struct csr_edges));
+	if (edges == NULL) {
+		return NULL;
+	}
+
+	// Partition sums are allocated per thread, so do not size them past the graph
+	part_pages = part_pages < npages ? part_pages : npages > 0 ? npages : 1;
+	edges->part_pages = part_pages;
+	edges->nparts = (npages + part_pages - 1) / part_pages;
+	edges->offsets = memory_malloc(MEMORY_EDGES, sizeof(int) * (edges->nparts + 1));
+	edges->edges = memory_malloc(MEMORY_EDGES, sizeof(struct edge) * (nedges > 0 ? nedges : 1));
+	if (edges->offsets == NULL || edges->edges == NULL) {
+		csr_edges_destroy(edges);
+		return NULL;
+	}
+
+	for (int p = 0; p <= edges->nparts; p++) {
+		edges->offsets[p] = graph->offsets[p * (long)part_pages < npages ? p * part_pages : npages];
+	}
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int p = 0; p < edges->nparts; p++) {
+		int last = (p + 1) * (long)part_pages < npages ? (p + 1) * part_pages : npages;
+		for (int i = p * part_pages; i < last; i++) {
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				edges->edges[e].source = graph->sources[e];
+				edges->edges[e].target = i;
+			}
+		}
+		qsort(&edges->edges[edges->offsets[p]], edges->offsets[p + 1] - edges->offsets[p], sizeof(struct edge), compare_edges);
+	}
+	return edges;
+}
+
+
+/**
+ * Rank csr edges by streaming them once per iteration
+ * Each iteration first streams the contribution (score / noutlinks) of every page into an
+ * array, then each thread takes whole partitions, streams their edges in order adding the
+ * contribution of the source to a sum for the target kept in a partition sized buffer of its
+ * own, and turns the sums into the new scores of the partition. Edges are only ever read
+ * sequentially and no two threads write the same sum.
+ * @param graph, the csr
+ * @param edges, the edges of the csr binned by target partition
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_edges_rank(struct csr* graph, struct csr_edges* edges, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	double* contributions = memory_malloc(MEMORY_SCRATCH, sizeof(double) * npages);
+	int nthreads = ncores < edges->nparts ? ncores : edges->nparts > 0 ? edges->nparts : 1;	// one partition each at most
+	double* sums = memory_malloc(MEMORY_SCRATCH, sizeof(double) * edges->part_pages * nthreads);
+	if (buffers[1] == NULL || contributions == NULL || sums == NULL) {
+		memory_free(MEMORY_SCORES, buffers[1]);
+		memory_free(MEMORY_SCRATCH, contributions);
+		memory_free(MEMORY_SCRATCH, sums);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		diff = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		#pragma omp parallel for schedule(static)
+		for (int i = 0; i < npages; i++) {
+			contributions[i] = old_scores[i] * graph->inv_outlinks[i];
+		}
+
+		#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1) reduction(+:diff)
+		for (int p = 0; p < edges->nparts; p++) {
+			int first = p * edges->part_pages;
+			int count = first + edges->part_pages < npages ? edges->part_pages : npages - first;
+			double* partition_sums = &sums[(size_t)omp_get_thread_num() * edges->part_pages];
+			memset(partition_sums, 0, sizeof(double) * count);
+			for (int e = edges->offsets[p]; e < edges->offsets[p + 1]; e++) {
+				partition_sums[edges->edges[e].target - first] += contributions[edges->edges[e].source];
+			}
+			for (int k = 0; k < count; k++) {
+				int i = first + k;
+				new_scores[i] = dampening_value + partition_sums[k] * dampener;
+				diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+			}
+		}
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+	}
+
+	if (buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	memory_free(MEMORY_SCORES, buffers[1]);
+	memory_free(MEMORY_SCRATCH, contributions);
+	memory_free(MEMORY_SCRATCH, sums);
+	return 0;
+}
+
+
+/* random walks started from every page by the monte carlo kernel, picked with -w (0 for the default) */
+static int monte_carlo_walks = 0;
+#define MONTE_CARLO_WALKS 64
+
+/* seed of the walks, so runs are repeatable */
+#define MONTE_CARLO_SEED 0x2545F4914F6CDD1DULL
+
+
+/**
+ * Mix a counter into a well distributed 64 bit value (the splitmix64 finaliser)
+ */
+static inline unsigned long long splitmix64(unsigned long long x) {
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+	return x ^ (x >> 31);
+}
+
+
+/**
+ * Estimate the scores of a csr from random walks
+ * Every page starts monte_carlo_walks (or MONTE_CARLO_WALKS) walks. At each page a walk stops
+ * with probability 1 - dampener, or at a page with no outlinks, and otherwise follows a random
+ * outlink. Every page a walk visits counts, and the score of a page is its visits times
+ * (1 - dampener) / (npages * walks), which is an unbiased estimate of the exact scores. Each
+ * thread counts the visits of its walks in its own array, added up per page once every walk is
+ * done, so a step needs no atomics. The random numbers of a walk are splitmix64 of a counter
+ * starting from its page and walk number, so the estimate is the same for any number of
+ * threads. The walks and steps taken and the estimated standard error of the largest score
+ * are reported on stderr.
+ * @param graph, the csr, with its outlinks built
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the estimated score of each page
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_monte_carlo_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	long walks = monte_carlo_walks > 0 ? monte_carlo_walks : MONTE_CARLO_WALKS;
+	omp_set_num_threads(ncores);
+	int nthreads = omp_get_max_threads();
+	long* visits = memory_calloc(MEMORY_SCRATCH, (size_t)npages * nthreads, sizeof(long));
+	if (visits == NULL) {
+		return -1;
+	}
+
+	long steps = 0;
+	#pragma omp parallel
+	{
+		long* counts = &visits[(size_t)omp_get_thread_num() * npages];
+
+		#pragma omp for schedule(dynamic, 64) reduction(+:steps)
+		for (int start = 0; start < npages; start++) {
+			for (long w = 0; w < walks; w++) {
+				unsigned long long counter = splitmix64(MONTE_CARLO_SEED ^ ((unsigned long long)start * walks + w));
+				int page = start;
+				while (1) {
+					counts[page]++;
+					steps++;
+					int degree = graph->out_offsets[page + 1] - graph->out_offsets[page];
+					unsigned long long random = splitmix64(counter += 0x9E3779B97F4A7C15ULL);
+					if (degree == 0 || (double)(random >> 11) * 0x1p-53 >= dampener) {
+						break;
+					}
+					page = graph->targets[graph->out_offsets[page] + (random & 0xFFFFFFFF) % degree];
+				}
+			}
+		}
+
+		// Add up the counts of every thread into the first thread's array
+		#pragma omp for
+		for (int i = 0; i < npages; i++) {
+			for (int t = 1; t < nthreads; t++) {
+				visits[i] += visits[(size_t)t * npages + i];
+			}
+		}
+	}
+
+	// Visits to a page are close to poisson distributed, so its error is about score / sqrt(visits)
+	double scale = (1.0 - dampener) / ((double)npages * (double)walks);
+	long most = 0;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = visits[i] * scale;
+		most = visits[i] > most ? visits[i] : most;
+	}
+	fprintf(stderr, "walks %ld steps %ld error %g\n", walks * npages, steps, most > 0 ? sqrt((double)most) * scale : 0.0);
+
+	memory_free(MEMORY_SCRATCH, visits);
+	return 0;
+}
+
+
+/* most worker processes the sharded kernel can split the pages between */
+#define MAX_SHARDS 64
+
+/* worker processes the sharded kernel splits the pages between, picked with -s, 0 for ncores */
+static int shard_count = 0;
+
+/* how often the parent checks that every worker of the sharded kernel is still alive */
+#define SHARD_POLL_MICROSECONDS 1000
+
+
+/**
+ * The part of a sharded ranking in POSIX shared memory, followed by the two score vectors
+ */
+struct shard_exchange {
+	pthread_barrier_t barrier;	// shared between the worker processes
+	double diffs[2][MAX_SHARDS];	// squared change of each shard, alternating between iterations
+	int iterations;
+};
+
+
+/**
+ * Rank the pages of one shard until the whole graph converges
+ * Each iteration the shard reads the scores of its sources, its own and its boundary pages
+ * owned by other shards, from the shared vector of the last iteration and writes the scores of
+ * its own pages into the other one. Every shard then waits at the barrier and adds up the
+ * changes of all shards in the same order, so they all stop after the same iteration.
+ * @param graph, the csr
+ * @param exchange, the shared memory
+ * @param vectors, the two shared score vectors
+ * @param bounds, shard s owns pages bounds[s] .. bounds[s + 1] - 1
+ * @param nshards, the number of shards
+ * @param shard, the shard to rank
+ * @param dampener, the dampening effect on the pages
+ */
+static void shard_run(const struct csr* graph, struct shard_exchange* exchange, double* vectors[2], const int* bounds,
+		int nshards, int shard, double dampener) {
+	int npages = graph->npages;
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	int iterations = 0;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON) {
+		const double* old_scores = vectors[iterations % 2];
+		double* new_scores = vectors[!(iterations % 2)];
+		double shard_diff = 0.0;
+
+		for (int i = bounds[shard]; i < bounds[shard + 1]; i++) {
+			double total = 0.0;
+			for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+				int src = graph->sources[e];
+				total += old_scores[src] * graph->inv_outlinks[src];
+			}
+			new_scores[i] = dampening_value + total * dampener;
+			shard_diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+		}
+		exchange->diffs[iterations % 2][shard] = shard_diff;
+		pthread_barrier_wait(&exchange->barrier);
+
+		diff = 0.0;
+		for (int s = 0; s < nshards; s++) {
+			diff += exchange->diffs[iterations % 2][s];
+		}
+		diff = sqrt(diff);
+		iterations++;
+	}
+	if (shard == 0) {
+		exchange->iterations = iterations;
+	}
+}
+
+
+/**
+ * Rank a csr with shard_count worker processes exchanging scores through shared memory
+ * The pages are split into ranges with about the same number of inlinks, one per shard, and
+ * every shard is ranked by a forked child as a local stand in for ranking across machines. This
+ * process only polls the children, and if one is killed or fails the others, which would wait at
+ * the barrier forever, are killed too. Each shard is ranked by a single thread, since OpenMP
+ * cannot start threads in a child forked after the loader used it, so the parallelism comes from
+ * the number of shards. The pages each shard reads from other shards every iteration, the scores a
+ * distributed ranking would have to send, are reported on stderr with the iterations.
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the final score of each page
+ * @return 0 on success, otherwise -1 if the shared memory or a worker cannot be created or a worker dies
+ */
+static int csr_sharded_rank(struct csr* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+	int nshards = shard_count > 0 ? shard_count : (ncores < MAX_SHARDS ? ncores : MAX_SHARDS);
+	nshards = nshards < npages ? nshards : npages;
+	int bounds[MAX_SHARDS + 1];
+	pid_t workers[MAX_SHARDS];
+
+	// Split the pages so each shard has about the same number of inlinks
+	bounds[0] = 0;
+	for (int s = 1; s < nshards; s++) {
+		long target = (long)graph->offsets[npages] * s / nshards;
+		int i = bounds[s - 1] + 1;
+		while (i < npages - (nshards - s) && graph->offsets[i] < target) {
+			i++;
+		}
+		bounds[s] = i;
+	}
+	bounds[nshards] = npages;
+
+	// Pages outside each shard read by it every iteration
+	char* seen = memory_calloc(MEMORY_SCRATCH, npages, 1);
+	if (seen == NULL) {
+		return -1;
+	}
+	long boundary = 0;
+	for (int s = 0; s < nshards; s++) {
+		memset(seen, 0, npages);
+		for (int e = graph->offsets[bounds[s]]; e < graph->offsets[bounds[s + 1]]; e++) {
+			int src = graph->sources[e];
+			if ((src < bounds[s] || src >= bounds[s + 1]) && !seen[src]) {
+				seen[src] = 1;
+				boundary++;
+			}
+		}
+	}
+	memory_free(MEMORY_SCRATCH, seen);
+
+	// Shared memory, unlinked at once so it goes away with the last worker
+	char name[64];
+	snprintf(name, sizeof(name), "/pagerank-%d", (int)getpid());
+	size_t size = sizeof(struct shard_exchange) + sizeof(double) * 2 * npages;
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+	shm_unlink(name);
+	void* shared = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (shared == MAP_FAILED) {
+		return -1;
+	}
+	struct shard_exchange* exchange = shared;
+	double* vectors[2] = { (double*)(exchange + 1), (double*)(exchange + 1) + npages };
+	pthread_barrierattr_t attr;
+	pthread_barrierattr_init(&attr);
+	pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	int failed = pthread_barrier_init(&exchange->barrier, &attr, nshards) != 0;
+	pthread_barrierattr_destroy(&attr);
+	if (failed) {
+		munmap(shared, size);
+		return -1;
+	}
+
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		vectors[0][i] = initial_value;
+	}
+
+	int started = 0;
+	fflush(stdout);
+	for (; started < nshards && !failed; started++) {
+		workers[started] = fork();
+		if (workers[started] == 0) {
+			shard_run(graph, exchange, vectors, bounds, nshards, started, dampener);
+			_exit(0);
+		}
+		failed = workers[started] < 0;
+	}
+	started -= failed;
+
+	// Watch the workers rather than joining the barrier, so one dying cannot hang the rest
+	int running = started;
+	while (running > 0 && !failed) {
+		running = 0;
+		for (int s = 0; s < started && !failed; s++) {
+			int status;
+			pid_t pid = workers[s] > 0 ? waitpid(workers[s], &status, WNOHANG) : 0;
+			if (pid != 0) {
+				// A reaped worker is marked with pid 0
+				failed = pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+				workers[s] = 0;
+			}
+			running += workers[s] > 0;
+		}
+		if (running > 0 && !failed) {
+			usleep(SHARD_POLL_MICROSECONDS);
+		}
+	}
+
+	// The barrier cannot complete without every shard, so stop the ones still running
+	for (int s = 0; s < started && failed; s++) {
+		if (workers[s] > 0) {
+			kill(workers[s], SIGKILL);
+			waitpid(workers[s], NULL, 0);
+		}
+	}
+
+	// A killed worker may have been inside the barrier, which destroying would then wait for
+	if (!failed) {
+		memcpy(scores, vectors[exchange->iterations % 2], sizeof(double) * npages);
+		fprintf(stderr, "shards %d boundary pages %ld iterations %d\n", nshards, boundary, exchange->iterations);
+		pthread_barrier_destroy(&exchange->barrier);
+	}
+	munmap(shared, size);
+	return failed ? -1 : 0;
+}
+
+
+#define CSR_PULL 0
+#define CSR_BLOCKED 1
+#define CSR_BALANCED 2
+#define CSR_BALANCED_SPLIT 3
+#define CSR_STEAL 4
+#define CSR_FLOAT 5
+#define CSR_MIXED 6
+#define CSR_COMPRESSED 7
+#define CSR_AITKEN 8
+#define CSR_QUADRATIC 9
+#define CSR_BICGSTAB 10
+#define CSR_GMRES 11
+#define CSR_SCC 12
+#define CSR_PUSH 13
+#define CSR_ADAPTIVE 14
+#define CSR_EDGE 15
+#define CSR_MONTE_CARLO 16
+#define CSR_SHARDED 17
+#define CSR_WEIGHTED 18
+
+
+/**
+ * Rank a csr with the given method
+ * The blocks, compressed inlinks and edge lists a method builds are freed again, so a graph can be
+ * ranked many times, unless it is ranked_once when CSR_COMPRESSED frees the inlinks it has replaced.
+ * The outlinks CSR_SCC, CSR_PUSH, CSR_ADAPTIVE and CSR_MONTE_CARLO build are kept on the csr for
+ * later rankings, until csr_destroy (pagerank_graph_destroy for a library graph).
+ * @param graph, the csr
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param method, CSR_PULL, CSR_BLOCKED, CSR_BALANCED, CSR_BALANCED_SPLIT, CSR_STEAL, CSR_FLOAT,
+ *     CSR_MIXED, CSR_COMPRESSED, CSR_AITKEN, CSR_QUADRATIC, CSR_BICGSTAB, CSR_GMRES, CSR_SCC,
+ *     CSR_PUSH, CSR_ADAPTIVE, CSR_EDGE, CSR_MONTE_CARLO, CSR_SHARDED or CSR_WEIGHTED, of which only
+ *     CSR_WEIGHTED reads the weights of a coalesced csr
+ * @param scores, filled with the score of each page of the csr
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_run(struct csr* graph, int ncores, double dampener, int method, double* scores) {
+	int npages = graph->npages;
+	struct csr_blocks* blocks = NULL;
+	struct csr_compressed* compressed = NULL;
+	struct csr_edges* edges = NULL;
+	int failed = 0;
+
+	if (method == CSR_BLOCKED) {
+		failed = (blocks = csr_blocks_create(graph, block_pages())) == NULL
+			|| csr_blocks_rank(graph, blocks, ncores, dampener, scores) != 0;
+	} else if (method == CSR_BALANCED || method == CSR_BALANCED_SPLIT) {
+		failed = csr_balanced_rank(graph, ncores, dampener, method == CSR_BALANCED_SPLIT, scores) != 0;
+	} else if (method == CSR_STEAL) {
+		failed = csr_steal_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_FLOAT || method == CSR_MIXED) {
+		failed = csr_rank_float(graph, ncores, dampener, method == CSR_MIXED, scores) != 0;
+	} else if (method == CSR_COMPRESSED) {
+		failed = (compressed = csr_compressed_create(graph, ncores)) == NULL;
+		if (!failed && graph->ranked_once) {
+			// Only the offsets and 1 / noutlinks of the csr are read from here on, if not taken over already
+			memory_free(MEMORY_EDGES, graph->sources);
+			graph->sources = NULL;
+		}
+		if (!failed) {
+			fprintf(stderr, "compressed %zu bytes for %d inlinks (%.2lf bytes per inlink)\n",
+					compressed->offsets[npages], graph->offsets[npages],
+					(double)compressed->offsets[npages] / (graph->offsets[npages] > 0 ? graph->offsets[npages] : 1));
+			failed = csr_compressed_rank(graph, compressed, ncores, dampener, scores) != 0;
+		}
+	} else if (method == CSR_AITKEN || method == CSR_QUADRATIC) {
+		failed = csr_extrapolated_rank(graph, ncores, dampener,
+				method == CSR_AITKEN ? EXTRAPOLATE_AITKEN : EXTRAPOLATE_QUADRATIC, scores) != 0;
+	} else if (method == CSR_BICGSTAB) {
+		failed = csr_bicgstab_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_GMRES) {
+		failed = csr_gmres_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_SCC) {
+		failed = csr_scc_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_PUSH || method == CSR_ADAPTIVE) {
+		failed = csr_build_outlinks(graph) != 0
+			|| push_pull_rank(graph, ncores, dampener, method == CSR_PUSH ? PUSH_ONLY : PUSH_ADAPTIVE, scores) != 0;
+	} else if (method == CSR_EDGE) {
+		int part_pages = block_pages() / ncores;
+		failed = (edges = csr_edges_create(graph, part_pages > 1024 ? part_pages : 1024)) == NULL
+			|| csr_edges_rank(graph, edges, ncores, dampener, scores) != 0;
+	} else if (method == CSR_MONTE_CARLO) {
+		failed = csr_build_outlinks(graph) != 0 || csr_monte_carlo_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_SHARDED) {
+		failed = csr_sharded_rank(graph, ncores, dampener, scores) != 0;
+	} else if (method == CSR_WEIGHTED) {
+		failed = csr_weighted_rank(graph, ncores, dampener, scores) != 0;
+	} else {
+		failed = csr_rank(graph, ncores, dampener, scores) != 0;
+	}
+
+	csr_blocks_destroy(blocks);
+	csr_compressed_destroy(compressed);
+	csr_edges_destroy(edges);
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * Build a csr from the pages, rank it with the given method and print the results
+ * The csr kernels below are each this with their method.
+ * @param plist, list of pages
+ * @param ncores, number of cores
+ * @param npages, number of pages
+ * @param nedges, number of edges
+ * @param dampener, the dampening effect on the pages
+ * @param method, one of the CSR_ methods
+ */
+static void pagerank_csr_run(list* plist, int ncores, int npages, int nedges, double dampener, int method) {
+	// Check for invalid parameters
+	if (plist == NULL || ncores <= 0 || npages <= 0 || nedges < 0 || dampener <= 0) {
+		return;
+	}
+
+	struct csr* graph = csr_prepare(plist, npages, nedges);
+	double* scores = memory_malloc(MEMORY_SCORES, sizeof(double) * npages);
+	if (graph != NULL) {
+		graph->ranked_once = 1;
+	}
+
+	// Print the results to stdout
+	if (graph != NULL && scores != NULL && csr_run(graph, ncores, dampener, method, scores) == 0) {
+		csr_print_scores(graph, scores);
+	}
+
+	memory_free(MEMORY_SCORES, scores);
+	csr_destroy(graph);
+}
+
+
+/** PageRank algorithm pulling over a csr of the inlinks */
+void pagerank_csr(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_PULL);
+}
+
+
+/** PageRank algorithm over a csr split into last level cache sized blocks of source pages */
+void pagerank_blocked(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_BLOCKED);
+}
+
+
+/** PageRank algorithm over a csr split between the threads by inlinks rather than pages */
+void pagerank_balanced(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_BALANCED);
+}
+
+
+/** PageRank algorithm over a csr split between the threads by inlinks, sharing hub pages */
+void pagerank_balanced_split(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_BALANCED_SPLIT);
+}
+
+
+/** PageRank algorithm with pthreads work stealing edge balanced page ranges */
+void pagerank_steal(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_STEAL);
+}
+
+
+/** PageRank algorithm pulling over a csr with single precision scores */
+void pagerank_float(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_FLOAT);
+}
+
+
+/** PageRank algorithm pulling over a csr in single precision, finishing in double precision */
+void pagerank_mixed(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_MIXED);
+}
+
+
+/** PageRank algorithm pulling over delta and varint compressed inlinks */
+void pagerank_compressed(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_COMPRESSED);
+}
+
+
+/** PageRank algorithm pulling over a csr with periodic Aitken extrapolation of the scores */
+void pagerank_aitken(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_AITKEN);
+}
+
+
+/** PageRank algorithm pulling over a csr with periodic quadratic extrapolation of the scores */
+void pagerank_quadratic(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_QUADRATIC);
+}
+
+
+/** PageRank algorithm solving the pagerank linear system over a csr with BiCGSTAB */
+void pagerank_bicgstab(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_BICGSTAB);
+}
+
+
+/** PageRank algorithm solving the pagerank linear system over a csr with restarted GMRES */
+void pagerank_gmres(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_GMRES);
+}
+
+
+/** PageRank algorithm ranking a csr one strongly connected component at a time */
+void pagerank_scc(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_SCC);
+}
+
+
+/** PageRank algorithm pushing changes in score along outlinks */
+void pagerank_push(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_PUSH);
+}
+
+
+/** PageRank algorithm choosing push or pull each iteration from the size of the active set */
+void pagerank_adaptive(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_ADAPTIVE);
+}
+
+
+/** PageRank algorithm streaming a flat array of edges binned by target partition */
+void pagerank_edge(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_EDGE);
+}
+
+
+/** PageRank estimated from random walks started at every page */
+void pagerank_montecarlo(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_MONTE_CARLO);
+}
+
+
+/** PageRank algorithm split between worker processes exchanging scores through shared memory */
+void pagerank_sharded(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_SHARDED);
+}
+
+
+/** PageRank algorithm over a csr with repeated edges merged into weighted ones */
+void pagerank_weighted(list* plist, int ncores, int npages, int nedges, double dampener) {
+	pagerank_csr_run(plist, ncores, npages, nedges, dampener, CSR_WEIGHTED);
+}
+
+
+/**
+ * Generate a random graph in place of reading one, for benchmarking large graphs
+ * Sources are uniform and destinations are skewed (a few pages own most of the inlinks)
+ * then scattered over the indices so hubs are not next to each other.
+ * @param plist, set to the generated list of pages
+ * @param npages, number of pages to generate
+ * @param nedges, number of edges to generate
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+int generate_graph(list** plist, int npages, int nedges) {
+	page** pages = malloc(sizeof(page*) * npages);
+	if (pages == NULL || (*plist = page_list_create()) == NULL) {
+		free(pages);
+		return -1;
+	}
+
+	char name[NAME_SIZE];
+	for (int i = 0; i < npages; i++) {
+		snprintf(name, NAME_SIZE, "p%d", i);
+		if ((pages[i] = page_create(name, i)) == NULL || page_list_add_end(*plist, pages[i]) == NULL) {
+			page_destroy(pages[i]);
+			free(pages);
+			return -1;
+		}
+	}
+
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	for (int e = 0; e < nedges; e++) {
+		// xorshift64* for the source then the destination
+		state ^= state >> 12; state ^= state << 25; state ^= state >> 27;
+		int src = (int)((state * 0x2545F4914F6CDD1DULL) >> 33) % npages;
+		state ^= state >> 12; state ^= state << 25; state ^= state >> 27;
+		double u = (double)((state * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+		int dst = (int)(((unsigned long long)(u * u * u * npages) * 2654435761ULL) % npages);
+
+		page* p = pages[dst];
+		if ((p->inlinks == NULL && (p->inlinks = page_list_create()) == NULL)
+				|| page_list_add_front(p->inlinks, pages[src]) == NULL) {
+			free(pages);
+			return -1;
+		}
+		pages[src]->noutlinks++;
+	}
+
+	free(pages);
+	return 0;
+}
+
+
+/**
+ * Open addressing hash table from page name to page index, interning the names in a string table
+ * Filled serially while reading the pages then only read, so the edge threads can look names
+ * up concurrently without locks.
+ */
+struct name_table {
+	int capacity;			// power of two
+	int* slots;			// page index, or -1 when empty
+	struct string_table* names;	// name of each index
+};
+
+
+/**
+ * Hash a page name (FNV-1a)
+ */
+static unsigned int name_hash(const char* name) {
+	unsigned int hash = 2166136261u;
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	}
+	return hash;
+}
+
+
+/**
+ * Add the next page name to a name table, keeping the first page when names repeat like page_list_find
+ * @return the index of the page, or -1 if an allocation fails
+ */
+static int name_table_add(struct name_table* table, const char* name) {
+	int index = string_table_add(table->names, name);
+	if (index < 0) {
+		return -1;
+	}
+	unsigned int slot = name_hash(name) & (table->capacity - 1);
+	while (table->slots[slot] >= 0) {
+		if (strcmp(string_table_get(table->names, table->slots[slot]), name) == 0) {
+			return index;
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	table->slots[slot] = index;
+	return index;
+}
+
+
+/**
+ * Find the index of the page with the given name
+ * @return the index, or -1 if there is no such page
+ */
+static int name_table_find(const struct name_table* table, const char* name) {
+	unsigned int slot = name_hash(name) & (table->capacity - 1);
+	while (table->slots[slot] >= 0) {
+		if (strcmp(string_table_get(table->names, table->slots[slot]), name) == 0) {
+			return table->slots[slot];
+		}
+		slot = (slot + 1) & (table->capacity - 1);
+	}
+	return -1;
+}
+
+
+/* keep the inlinks in files under this directory instead of memory, picked with -e */
+static const char* external_dir = NULL;
+
+/* most edges distributed into each destination bucket, sorted in memory one bucket at a time */
+#define EXTERNAL_BUCKET_EDGES (1 << 24)
+
+/* edges read from the inlink file into each of the two buffers while the other is ranked */
+#define EXTERNAL_CHUNK_EDGES (1 << 20)
+
+
+/**
+ * The inlinks of every page in a file rather than memory, for graphs larger than memory
+ * Only arrays with one entry per page are kept in memory.
+ */
+struct external_graph {
+	int npages;
+	long nedges;
+	long* offsets;		// inlinks of page i are sources offsets[i] .. offsets[i + 1] - 1 of the file
+	double* inv_outlinks;	// 1 / noutlinks for each page, 0 when the page has no outlinks
+	struct string_table* names;	// page names in input order
+	FILE* file;		// the source of every inlink grouped by target, already unlinked
+};
+
+
+/* the graph read_input_external built, ranked by the external kernel */
+static struct external_graph* external_loaded = NULL;
+
+
+/**
+ * Clean up an external graph, deleting its inlink file
+ * @param graph, the graph to free
+ */
+void external_graph_destroy(struct external_graph* graph) {
+	if (graph == NULL) {
+		return;
+	}
+	memory_free(MEMORY_PAGES, graph->offsets);
+	memory_free(MEMORY_PAGES, graph->inv_outlinks);
+	string_table_destroy(graph->names);
+	if (graph->file != NULL) {
+		fclose(graph->file);
+	}
+	free(graph);
+}
+
+
+/**
+ * Create a temporary file under external_dir, unlinked so it is deleted once closed
+ * @return the file open for reading and writing, or NULL if it cannot be created
+ */
+static FILE* external_temp_file(void) {
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof(path), "%s/pagerank-XXXXXX", external_dir) >= (int)sizeof(path)) {
+		return NULL;
+	}
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		return NULL;
+	}
+	unlink(path);
+	FILE* file = fdopen(fd, "w+");
+	if (file == NULL) {
+		close(fd);
+	}
+	return file;
+}
+
+
+/**
+ * Read the input in the same format as read_input, keeping the inlinks in a file under external_dir
+ * The edges are streamed from stdin into one file per range of target pages, sized so each
+ * holds about EXTERNAL_BUCKET_EDGES edges. Each bucket is then read back, sorted by target
+ * in memory and appended to the inlink file, so every pass over the disk is sequential and
+ * only one bucket of edges is ever in memory. Inlinks come newest first like read_input. The
+ * pages go into the list without inlinks, so only the external kernel can rank them.
+ * die() is called if there are any input errors
+ */
+void read_input_external(list** plist, int* ncores, int* npages, int* nedges, double* dampener) {
+	char line[LONG_LINE_SIZE];
+	char src_name[LONG_NAME_SIZE];
+	char dst_name[LONG_NAME_SIZE];
+	char excess[LONG_LINE_SIZE];
+
+	/* check for invalid input */
+
+	if (fgets(line, LINE_SIZE, stdin) == NULL || sscanf(line, "%d\n", ncores) != 1 || *ncores == 0
+			|| fgets(line, LINE_SIZE, stdin) == NULL || sscanf(line, "%lf\n", dampener) != 1
+			|| *dampener < 0 || fabs(*dampener) > 1
+			|| fgets(line, LINE_SIZE, stdin) == NULL || sscanf(line, "%d\n", npages) != 1 || *npages <= 0) {
+		die(*plist);
+	}
+	int n = *npages;
+
+	struct external_graph* graph = calloc(1, sizeof(struct external_graph));
+	struct name_table table = { 1, NULL, string_table_create(n) };
+	while (table.capacity < 2 * n) {
+		table.capacity *= 2;
+	}
+	table.slots = memory_malloc(MEMORY_NAMES, sizeof(int) * table.capacity);
+	int* noutlinks = calloc(n, sizeof(int));
+	if (graph != NULL) {
+		graph->npages = n;
+		graph->offsets = memory_calloc(MEMORY_PAGES, n + 1, sizeof(long));
+		graph->inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * n);
+		graph->names = table.names;
+	}
+	int failed = (*plist = page_list_create()) == NULL || graph == NULL || table.slots == NULL || table.names == NULL
+		|| noutlinks == NULL || graph->offsets == NULL || graph->inv_outlinks == NULL;
+	if (failed && graph == NULL) {
+		string_table_destroy(table.names);
+	}
+	if (!failed) {
+		memset(table.slots, -1, sizeof(int) * table.capacity);
+	}
+
+	for (int i = 0; i < n && !failed; i++) {
+		page* p = NULL;
+		failed = fgets(line, LINE_SIZE, stdin) == NULL
+			|| sscanf(line, long_names ? "%100s\n" : "%20s\n", src_name) != 1 || name_table_add(&table, src_name) != i;
+		if (!failed) {
+			src_name[NAME_SIZE - 1] = '\0';
+			failed = (p = page_create(src_name, i)) == NULL || page_list_add_end(*plist, p) == NULL;
+		}
+		if (failed) {
+			page_destroy(p);
+		}
+	}
+	long m = 0;
+	failed = failed || fgets(line, LINE_SIZE, stdin) == NULL || sscanf(line, "%ld %s\n", &m, excess) != 1 || m < 0;
+
+	// Distribute the edges into buckets of target pages, counting the inlinks and outlinks of every page
+	int nbuckets = failed ? 0 : (int)((m + EXTERNAL_BUCKET_EDGES - 1) / EXTERNAL_BUCKET_EDGES);
+	nbuckets = nbuckets < 1 ? 1 : nbuckets > n ? n : nbuckets;
+	int bucket_pages = (n + nbuckets - 1) / nbuckets;
+	FILE** buckets = calloc(nbuckets, sizeof(FILE*));
+	failed = failed || buckets == NULL;
+	for (int b = 0; b < nbuckets && !failed; b++) {
+		failed = (buckets[b] = external_temp_file()) == NULL;
+	}
+	for (long e = 0; e < m && !failed; e++) {
+		int edge[2] = { -1, -1 };
+		if (fgets(line, LINE_SIZE, stdin) != NULL
+				&& sscanf(line, long_names ? "%100s %100s %s\n" : "%20s %20s %s\n", src_name, dst_name, excess) == 2) {
+			edge[0] = name_table_find(&table, src_name);
+			edge[1] = name_table_find(&table, dst_name);
+		}
+		failed = edge[0] < 0 || edge[1] < 0 || fwrite(edge, sizeof(int), 2, buckets[edge[1] / bucket_pages]) != 2;
+		if (!failed) {
+			graph->offsets[edge[1] + 1]++;
+			noutlinks[edge[0]]++;
+		}
+	}
+
+	if (!failed) {
+		for (int i = 0; i < n; i++) {
+			graph->offsets[i + 1] += graph->offsets[i];
+			graph->inv_outlinks[i] = noutlinks[i] > 0 ? 1.0 / (double)noutlinks[i] : 0.0;
+		}
+		int i = 0;
+		for (node* current = (*plist)->head; current != NULL; current = current->next) {
+			current->page->noutlinks = noutlinks[i++];
+		}
+		graph->nedges = m;
+		failed = (graph->file = external_temp_file()) == NULL;
+	}
+
+	// Sort each bucket by target in memory, filling each page's inlinks from the back
+	long largest = 0;
+	for (int b = 0; b < nbuckets && !failed; b++) {
+		int last = (b + 1) * bucket_pages < n ? (b + 1) * bucket_pages : n;
+		long count = graph->offsets[last] - graph->offsets[b * bucket_pages];
+		largest = count > largest ? count : largest;
+	}
+	int* edges = failed ? NULL : malloc(sizeof(int) * 2 * (largest > 0 ? largest : 1));
+	int* sources = failed ? NULL : malloc(sizeof(int) * (largest > 0 ? largest : 1));
+	failed = failed || edges == NULL || sources == NULL;
+	for (int b = 0; b < nbuckets && !failed; b++) {
+		int first = b * bucket_pages;
+		int last = first + bucket_pages < n ? first + bucket_pages : n;
+		long base = first < n ? graph->offsets[first] : m;
+		long count = (first < n ? graph->offsets[last] : m) - base;
+		failed = fflush(buckets[b]) != 0 || fseek(buckets[b], 0, SEEK_SET) != 0
+			|| fread(edges, sizeof(int) * 2, count, buckets[b]) != (size_t)count;
+		for (int i = first; i < last && !failed; i++) {
+			noutlinks[i] = (int)(graph->offsets[i + 1] - base);	// reused as the end of each page's slots
+		}
+		for (long e = 0; e < count && !failed; e++) {
+			sources[--noutlinks[edges[2 * e + 1]]] = edges[2 * e];
+		}
+		failed = failed || fwrite(sources, sizeof(int), count, graph->file) != (size_t)count;
+		fclose(buckets[b]);
+		buckets[b] = NULL;
+	}
+	failed = failed || fflush(graph->file) != 0;
+
+	for (int b = 0; buckets != NULL && b < nbuckets; b++) {
+		if (buckets[b] != NULL) {
+			fclose(buckets[b]);
+		}
+	}
+	free(buckets);
+	free(edges);
+	free(sources);
+	free(noutlinks);
+	memory_free(MEMORY_NAMES, table.slots);
+	if (failed) {
+		external_graph_destroy(graph);
+		die(*plist);
+	}
+	*nedges = m > INT_MAX ? INT_MAX : (int)m;
+	external_loaded = graph;
+}
+
+
+/**
+ * The inlink file reader running one chunk of pages ahead of the ranking
+ */
+struct external_reader {
+	const struct external_graph* graph;
+	const int* chunks;		// chunk k is pages chunks[k] .. chunks[k + 1] - 1
+	int nchunks;
+	int* buffers[2];		// chunk k is read into buffers[k % 2]
+	int full[2];
+	int stop;
+	int failed;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+
+/**
+ * Read the chunks of the inlink file in order into alternate buffers, over and over until stopped
+ */
+static void* external_reader_run(void* arg) {
+	struct external_reader* reader = arg;
+	const struct external_graph* graph = reader->graph;
+	int fd = fileno(graph->file);
+	for (long k = 0; ; k++) {
+		int b = k % 2;
+		pthread_mutex_lock(&reader->lock);
+		while (reader->full[b] && !reader->stop) {
+			pthread_cond_wait(&reader->changed, &reader->lock);
+		}
+		int stop = reader->stop;
+		pthread_mutex_unlock(&reader->lock);
+		if (stop) {
+			return NULL;
+		}
+
+		int c = k % reader->nchunks;
+		long first = graph->offsets[reader->chunks[c]];
+		size_t size = sizeof(int) * (graph->offsets[reader->chunks[c + 1]] - first);
+		size_t done = 0;
+		int failed = 0;
+		while (done < size && !failed) {
+			ssize_t count = pread(fd, (char*)reader->buffers[b] + done, size - done, sizeof(int) * first + done);
+			failed = count <= 0;
+			done += count > 0 ? count : 0;
+		}
+
+		pthread_mutex_lock(&reader->lock);
+		reader->full[b] = 1;
+		reader->failed = reader->failed || failed;
+		pthread_cond_broadcast(&reader->changed);
+		pthread_mutex_unlock(&reader->lock);
+	}
+}
+
+
+/**
+ * Rank an external graph by streaming its inlink file once per iteration
+ * The pages are split into chunks of about EXTERNAL_CHUNK_EDGES inlinks. A reader thread
+ * reads the next chunk into one buffer while the threads rank the pages of the other.
+ * @param graph, the graph
+ * @param ncores, number of cores
+ * @param dampener, the dampening effect on the pages
+ * @param scores, filled with the score of each page
+ * @return 0 on success, otherwise -1 if an allocation or a read fails
+ */
+static int external_rank(const struct external_graph* graph, int ncores, double dampener, double* scores) {
+	int npages = graph->npages;
+
+	// Chunks end on page boundaries, so a chunk may hold more than EXTERNAL_CHUNK_EDGES for a hub page
+	int nchunks = 0;
+	long largest = 1;
+	int* chunks = malloc(sizeof(int) * (npages + 1));
+	if (chunks != NULL) {
+		chunks[0] = 0;
+		for (int i = 0; i < npages; ) {
+			int last = i + 1;
+			while (last < npages && graph->offsets[last + 1] - graph->offsets[i] <= EXTERNAL_CHUNK_EDGES) {
+				last++;
+			}
+			largest = graph->offsets[last] - graph->offsets[i] > largest ? graph->offsets[last] - graph->offsets[i] : largest;
+			chunks[++nchunks] = last;
+			i = last;
+		}
+	}
+
+	struct external_reader reader = {
+		.graph = graph,
+		.chunks = chunks,
+		.nchunks = nchunks,
+		.buffers = { malloc(sizeof(int) * largest), malloc(sizeof(int) * largest) },
+		.full = { 0, 0 },
+		.stop = 0,
+		.failed = 0,
+	};
+	pthread_mutex_init(&reader.lock, NULL);
+	pthread_cond_init(&reader.changed, NULL);
+	double* buffers[2] = { scores, memory_malloc(MEMORY_SCORES, sizeof(double) * npages) };
+	pthread_t thread;
+	int failed = chunks == NULL || buffers[1] == NULL || reader.buffers[0] == NULL || reader.buffers[1] == NULL;
+	if (!failed) {
+		posix_fadvise(fileno(graph->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+		failed = pthread_create(&thread, NULL, external_reader_run, &reader) != 0;
+	}
+	if (failed) {
+		pthread_mutex_destroy(&reader.lock);
+		pthread_cond_destroy(&reader.changed);
+		free(chunks);
+		memory_free(MEMORY_SCORES, buffers[1]);
+		free(reader.buffers[0]);
+		free(reader.buffers[1]);
+		return -1;
+	}
+	omp_set_num_threads(ncores);
+
+	double dampening_value = (1.0 - dampener) / ((double)npages);
+	double initial_value = 1 / (double)npages;
+	for (int i = 0; i < npages; i++) {
+		scores[i] = initial_value;
+	}
+
+	int x = 1;
+	long k = 0;
+	double diff = 1;
+
+	// Loop through until the convergence threshold is reached
+	while (diff > EPSILON && !failed) {
+		diff = 0.0;
+		const double* old_scores = buffers[!x];
+		double* new_scores = buffers[x];
+
+		for (int c = 0; c < nchunks && !failed; c++, k++) {
+			int b = k % 2;
+			pthread_mutex_lock(&reader.lock);
+			while (!reader.full[b] && !reader.failed) {
+				pthread_cond_wait(&reader.changed, &reader.lock);
+			}
+			failed = reader.failed;
+			pthread_mutex_unlock(&reader.lock);
+			if (failed) {
+				break;
+			}
+
+			const int* sources = reader.buffers[b];
+			long first = graph->offsets[chunks[c]];
+			#pragma omp parallel for reduction(+:diff)
+			for (int i = chunks[c]; i < chunks[c + 1]; i++) {
+				double total = 0.0;
+				for (long e = graph->offsets[i] - first; e < graph->offsets[i + 1] - first; e++) {
+					int src = sources[e];
+					total += old_scores[src] * graph->inv_outlinks[src];
+				}
+				new_scores[i] = dampening_value + total * dampener;
+				diff += (new_scores[i] - old_scores[i]) * (new_scores[i] - old_scores[i]);
+			}
+
+			pthread_mutex_lock(&reader.lock);
+			reader.full[b] = 0;
+			pthread_cond_broadcast(&reader.changed);
+			pthread_mutex_unlock(&reader.lock);
+		}
+
+		x = !x;	// Update the value so we do not have to copy
+		diff = sqrt(diff);
+	}
+
+	pthread_mutex_lock(&reader.lock);
+	reader.stop = 1;
+	pthread_cond_broadcast(&reader.changed);
+	pthread_mutex_unlock(&reader.lock);
+	pthread_join(thread, NULL);
+	pthread_mutex_destroy(&reader.lock);
+	pthread_cond_destroy(&reader.changed);
+
+	if (!failed && buffers[!x] != scores) {
+		memcpy(scores, buffers[!x], sizeof(double) * npages);
+	}
+	free(chunks);
+	memory_free(MEMORY_SCORES, buffers[1]);
+	free(reader.buffers[0]);
+	free(reader.buffers[1]);
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * PageRank algorithm streaming the inlinks from the file read_input_external wrote
+ * Given a list of pages calculate the ranking of the pages using a dampening effect
+ * @param plist, list of pages
+ * @param ncores, number of cores
+ * @param npages, number of pages
+ * @param nedges, number of edges
+ * @param dampener, the dampening effect on the pages
+ */
+void pagerank_external(list* plist, int ncores, int npages, int nedges, double dampener) {
+	struct external_graph* graph = external_loaded;
+	external_loaded = NULL;
+
+	// Check for invalid parameters
+	if (plist == NULL || graph == NULL || ncores <= 0 || npages <= 0 || nedges < 0 || dampener <= 0) {
+		external_graph_destroy(graph);
+		return;
+	}
+
+	double* scores = memory_malloc(MEMORY_SCORES, sizeof(double) * npages);
+	if (scores != NULL && external_rank(graph, ncores, dampener, scores) == 0) {
+		// Print the results to stdout
+		for (int i = 0; i < npages; i++) {
+			printf("%s %.4lf\n", string_table_get(graph->names, i), scores[i]);
+		}
+	}
+
+	memory_free(MEMORY_SCORES, scores);
+	external_graph_destroy(graph);
+}
+
+
+/**
+ * Read a line of a buffer into line like fgets would, NUL terminated and at most LINE_SIZE - 1 long
+ * @param cursor, the position to read from, moved past the line
+ * @param end, the end of the buffer
+ * @param line, filled with the line
+ * @return 0 on success, otherwise -1 at the end of the buffer
+ */
+static int buffer_read_line(const char** cursor, const char* end, char* line) {
+	if (*cursor >= end) {
+		return -1;
+	}
+	const char* newline = memchr(*cursor, '\n', end - *cursor);
+	const char* line_end = newline != NULL ? newline + 1 : end;
+	size_t length = line_end - *cursor;
+	if (length > LINE_SIZE - 1) {
+		length = LINE_SIZE - 1;
+	}
+	memcpy(line, *cursor, length);
+	line[length] = '\0';
+	*cursor = line_end;
+	return 0;
+}
+
+
+/**
+ * Build the inlink lists the list kernels use from a csr, with one page per thread at a time
+ * @param graph, the csr
+ * @param pages, the page of each csr index
+ * @param nthreads, the number of threads
+ * @return 0 on success, otherwise -1 if an allocation fails
+ */
+static int csr_build_inlink_lists(const struct csr* graph, page** pages, int nthreads) {
+	int failed = 0;
+	#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 64) reduction(||:failed)
+	for (int i = 0; i < graph->npages; i++) {
+		if (graph->offsets[i] == graph->offsets[i + 1]) {
+			continue;
+		}
+		page* p = pages[i];
+		if ((p->inlinks = page_list_create()) == NULL) {
+			failed = 1;
+			continue;
+		}
+		for (int e = graph->offsets[i]; e < graph->offsets[i + 1]; e++) {
+			if (page_list_add_end(p->inlinks, pages[graph->sources[e]]) == NULL) {
+				failed = 1;
+				break;
+			}
+		}
+	}
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * Build the graph from input in the same format as read_input, with ncores threads
+ * The pages are added serially to the list and a hash table, then the edge lines are split
+ * into one chunk of bytes per thread. Each thread counts its lines, parses them, resolves both
+ * names through the hash table and counts the inlinks and outlinks of every page in its own
+ * histogram. Prefix sums over the histograms give every
+ * thread its own slots in a csr of the inlinks, filled in the order read_input would build the
+ * inlink lists, which are then built from the csr with one page per thread at a time.
+ * @param input, the input
+ * @param size, the length of the input in bytes
+ * @param plist, set to the list of pages, left for the caller to destroy even on failure
+ * @param ncores, set to the number of cores
+ * @param npages, set to the number of pages
+ * @param nedges, set to the number of edges
+ * @param dampener, set to the dampening effect
+ * @param names, if not NULL set to the hash table of the page names, sharing the csr's string table
+ * @return the csr, or NULL if the input is invalid or an allocation fails
+ */
+static struct csr* csr_load(const char* input, size_t size, list** plist, int* ncores, int* npages, int* nedges,
+		double* dampener, struct name_table* names) {
+	char line[LONG_LINE_SIZE];
+	char name1[LONG_NAME_SIZE];
+	char excess[LONG_LINE_SIZE];
+	const char* cursor = input;
+	const char* end = input + size;
+
+	/* check for invalid input */
+
+	if (buffer_read_line(&cursor, end, line) != 0 || sscanf(line, "%d\n", ncores) != 1 || *ncores == 0
+			|| buffer_read_line(&cursor, end, line) != 0 || sscanf(line, "%lf\n", dampener) != 1
+			|| *dampener < 0 || fabs(*dampener) > 1
+			|| buffer_read_line(&cursor, end, line) != 0 || sscanf(line, "%d\n", npages) != 1 || *npages == 0) {
+		return NULL;
+	}
+	int nthreads = *ncores > 0 ? *ncores : 1;
+	int n = *npages > 0 ? *npages : 0;
+
+	// Pages go into the list and name table in order, with long names cut short in the page list
+	page** pages = memory_malloc(MEMORY_PAGES, sizeof(page*) * (n > 0 ? n : 1));
+	struct name_table table = { 1, NULL, string_table_create(n) };
+	while (table.capacity < 2 * n) {
+		table.capacity *= 2;
+	}
+	table.slots = memory_malloc(MEMORY_NAMES, sizeof(int) * table.capacity);
+	if ((*plist = page_list_create()) == NULL || pages == NULL || table.slots == NULL || table.names == NULL) {
+		memory_free(MEMORY_PAGES, pages);
+		memory_free(MEMORY_NAMES, table.slots);
+		string_table_destroy(table.names);
+		return NULL;
+	}
+	memset(table.slots, -1, sizeof(int) * table.capacity);
+
+	int failed = 0;
+	for (int i = 0; i < n && !failed; i++) {
+		page* p = NULL;
+		failed = buffer_read_line(&cursor, end, line) != 0
+			|| sscanf(line, long_names ? "%100s\n" : "%20s\n", name1) != 1 || name_table_add(&table, name1) != i;
+		if (!failed) {
+			name1[NAME_SIZE - 1] = '\0';
+			failed = (p = page_create(name1, i)) == NULL || page_list_add_end(*plist, p) == NULL;
+		}
+		if (!failed) {
+			pages[i] = p;
+		} else {
+			page_destroy(p);
+		}
+	}
+	failed = failed || buffer_read_line(&cursor, end, line) != 0 || sscanf(line, "%d %s\n", nedges, excess) != 1;
+
+	// One chunk of the remaining bytes per thread, each starting after the first newline in it
+	int m = failed || *nedges < 0 ? 0 : *nedges;
+	size_t remaining = end - cursor;
+	long* first_lines = memory_calloc(MEMORY_SCRATCH, nthreads + 1, sizeof(long));
+	int* edge_sources = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (m > 0 ? m : 1));
+	int* edge_targets = memory_malloc(MEMORY_SCRATCH, sizeof(int) * (m > 0 ? m : 1));
+	int* histograms = memory_calloc(MEMORY_SCRATCH, (size_t)nthreads * 2 * n, sizeof(int));	// inlinks then outlinks per thread
+	struct csr* graph = memory_calloc(MEMORY_PAGES, 1, sizeof(struct csr));
+	if (graph != NULL) {
+		graph->offsets = memory_calloc(MEMORY_PAGES, n + 1, sizeof(int));
+		graph->sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (m > 0 ? m : 1));
+		graph->inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * n);
+	}
+	failed = failed || first_lines == NULL || edge_sources == NULL || edge_targets == NULL || histograms == NULL
+		|| graph == NULL || graph->offsets == NULL || graph->sources == NULL || graph->inv_outlinks == NULL;
+
+	if (!failed) {
+		#pragma omp parallel num_threads(nthreads)
+		{
+			int t = omp_get_thread_num();
+			int team = omp_get_num_threads();
+			const char* chunk = cursor + remaining * t / team;
+			const char* chunk_end = cursor + remaining * (t + 1) / team;
+			if (t > 0) {
+				const char* newline = memchr(chunk - 1, '\n', end - chunk + 1);
+				chunk = newline != NULL ? newline + 1 : end;
+			}
+
+			// Count the lines starting in this chunk
+			long lines = 0;
+			for (const char* c = chunk; c < chunk_end; lines++) {
+				const char* newline = memchr(c, '\n', end - c);
+				c = newline != NULL ? newline + 1 : end;
+			}
+			first_lines[t + 1] = lines;
+
+			#pragma omp barrier
+			#pragma omp single
+			for (int i = 0; i < team; i++) {
+				first_lines[i + 1] += first_lines[i];
+			}
+
+			// Parse and resolve the edge lines of this chunk, counting into this thread's histograms
+			int* inlinks = &histograms[(size_t)t * 2 * n];
+			int* outlinks = inlinks + n;
+			char buffer[LONG_LINE_SIZE];
+			char src_name[LONG_NAME_SIZE];
+			char dst_name[LONG_NAME_SIZE];
+			char rest[LONG_LINE_SIZE];
+			const char* c = chunk;
+			for (long e = first_lines[t]; e < first_lines[t + 1] && e < m; e++) {
+				buffer_read_line(&c, end, buffer);
+				int src = -1;
+				int dst = -1;
+				if (sscanf(buffer, long_names ? "%100s %100s %s\n" : "%20s %20s %s\n", src_name, dst_name, rest) == 2) {
+					src = name_table_find(&table, src_name);
+					dst = name_table_find(&table, dst_name);
+				}
+				if (src < 0 || dst < 0) {
+					#pragma omp atomic write
+					failed = 1;
+					break;
+				}
+				edge_sources[e] = src;
+				edge_targets[e] = dst;
+				inlinks[dst]++;
+				outlinks[src]++;
+			}
+		}
+		failed = failed || first_lines[nthreads] < m;
+	}
+
+	if (!failed) {
+		// Prefix sums of the inlinks of each page, each thread's histogram becomes the end of its slots
+		int total = 0;
+		for (int i = 0; i < n; i++) {
+			graph->offsets[i] = total;
+			int noutlinks = 0;
+			for (int t = 0; t < nthreads; t++) {
+				total += histograms[(size_t)t * 2 * n + i];
+				histograms[(size_t)t * 2 * n + i] = total;
+				noutlinks += histograms[(size_t)t * 2 * n + n + i];
+			}
+			pages[i]->noutlinks = noutlinks;
+			graph->inv_outlinks[i] = noutlinks > 0 ? 1.0 / (double)noutlinks : 0.0;
+		}
+		graph->offsets[n] = total;
+		graph->npages = n;
+		graph->nedges = m;
+
+		// Scatter from the back so each page's inlinks are newest first like page_list_add_front
+		#pragma omp parallel num_threads(nthreads)
+		{
+			int t = omp_get_thread_num();
+			int* slots = &histograms[(size_t)t * 2 * n];
+			for (long e = first_lines[t]; e < first_lines[t + 1] && e < m; e++) {
+				graph->sources[--slots[edge_targets[e]]] = edge_sources[e];
+			}
+		}
+
+		failed = csr_build_inlink_lists(graph, pages, nthreads) != 0;
+	}
+
+	if (graph != NULL) {
+		graph->pages = pages;
+		graph->names = table.names;
+		pages = NULL;
+		table.names = NULL;
+	}
+	memory_free(MEMORY_PAGES, pages);
+	string_table_destroy(table.names);
+	memory_free(MEMORY_SCRATCH, first_lines);
+	memory_free(MEMORY_SCRATCH, edge_sources);
+	memory_free(MEMORY_SCRATCH, edge_targets);
+	memory_free(MEMORY_SCRATCH, histograms);
+	if (failed) {
+		memory_free(MEMORY_NAMES, table.slots);
+		csr_destroy(graph);
+		return NULL;
+	}
+	if (names != NULL) {
+		*names = table;
+		names->names = graph->names;
+	} else {
+		memory_free(MEMORY_NAMES, table.slots);
+	}
+	return graph;
+}
+
+
+/**
+ * Read all of a stream into memory
+ * @param stream, the stream to read
+ * @param size, set to the number of bytes read
+ * @return the bytes read, or NULL if an allocation fails
+ */
+static char* read_stream(FILE* stream, size_t* size) {
+	size_t capacity = 1 << 20;
+	char* input = malloc(capacity);
+	size_t count;
+	*size = 0;
+	while (input != NULL && (count = fread(input + *size, 1, capacity - *size, stream)) > 0) {
+		*size += count;
+		if (*size == capacity) {
+			char* grown = realloc(input, capacity *= 2);
+			if (grown == NULL) {
+				free(input);
+			}
+			input = grown;
+		}
+	}
+	return input;
+}
+
+
+#define PIPELINE_BLOCK (1 << 20)	// bytes of stdin the pipelined reader reads at a time
+
+
+/**
+ * A block of whole input lines read by the pipelined reader, with the edges parsed from it
+ */
+struct pipeline_block {
+	char* bytes;			// freed once parsed
+	size_t size;
+	size_t start;			// offset of the first line not yet read
+	int nedges;			// edge lines from start to parse
+	int* sources;
+	int* targets;
+	struct pipeline_block* next;
+};
+
+
+/**
+ * The blocks of a stream passed from the pipelined reader to the loader, kept in input order
+ */
+struct pipeline {
+	FILE* stream;
+	struct pipeline_block* head;
+	struct pipeline_block* tail;
+	int done;			// the reader reached the end of the stream
+	int failed;			// a read or an allocation failed
+	int stop;			// the loader needs no more blocks
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+
+/**
+ * Read a stream into blocks that end on a newline, appending each to the pipeline as it is read
+ */
+static void* pipeline_reader_run(void* arg) {
+	struct pipeline* pipe = arg;
+	char* carry = memory_malloc(MEMORY_SCRATCH, PIPELINE_BLOCK);	// the unfinished last line of the previous block
+	size_t ncarry = 0;
+	int done = 0;
+	int failed = carry == NULL;
+	while (!done && !failed) {
+		struct pipeline_block* block = memory_calloc(MEMORY_SCRATCH, 1, sizeof(struct pipeline_block));
+		char* bytes = block != NULL ? memory_malloc(MEMORY_SCRATCH, ncarry + PIPELINE_BLOCK) : NULL;
+		if (bytes == NULL) {
+			memory_free(MEMORY_SCRATCH, block);
+			failed = 1;
+			break;
+		}
+		memcpy(bytes, carry, ncarry);
+		size_t size = ncarry + fread(bytes + ncarry, 1, PIPELINE_BLOCK, pipe->stream);
+		done = size < ncarry + PIPELINE_BLOCK;
+		failed = ferror(pipe->stream);
+
+		// A line longer than a whole block is split, the loader only reads its start anyway
+		size_t end = size;
+		while (!done && end > 0 && bytes[end - 1] != '\n') {
+			end--;
+		}
+		end = end > 0 ? end : size;
+		ncarry = size - end;
+		memcpy(carry, bytes + end, ncarry);
+		block->bytes = bytes;
+		block->size = end;
+
+		pthread_mutex_lock(&pipe->lock);
+		if (pipe->tail != NULL) {
+			pipe->tail->next = block;
+		} else {
+			pipe->head = block;
+		}
+		pipe->tail = block;
+		pipe->done = done;
+		pipe->failed = failed;
+		done = done || pipe->stop;
+		pthread_cond_broadcast(&pipe->changed);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+
+	pthread_mutex_lock(&pipe->lock);
+	pipe->done = 1;
+	pipe->failed = pipe->failed || failed;
+	pthread_cond_broadcast(&pipe->changed);
+	pthread_mutex_unlock(&pipe->lock);
+	memory_free(MEMORY_SCRATCH, carry);
+	return NULL;
+}
+
+
+/**
+ * Wait for the block after a block of a pipeline
+ * @param pipe, the pipeline
+ * @param block, the block, or NULL for the first block
+ * @return the next block, or NULL if the reader stopped without one
+ */
+static struct pipeline_block* pipeline_next(struct pipeline* pipe, struct pipeline_block* block) {
+	struct pipeline_block* next;
+	pthread_mutex_lock(&pipe->lock);
+	while ((next = block != NULL ? block->next : pipe->head) == NULL && !pipe->done) {
+		pthread_cond_wait(&pipe->changed, &pipe->lock);
+	}
+	pthread_mutex_unlock(&pipe->lock);
+	return next;
+}
+
+
+/**
+ * Read the next line of a pipeline like buffer_read_line, freeing the blocks it finishes
+ * @param pipe, the pipeline
+ * @param block, the block being read, NULL before the first, moved on to the block of the line
+ * @param line, filled with the line
+ * @return 0 on success, otherwise -1 at the end of the stream
+ */
+static int pipeline_read_line(struct pipeline* pipe, struct pipeline_block** block, char* line) {
+	while (*block == NULL || (*block)->start >= (*block)->size) {
+		struct pipeline_block* next = pipeline_next(pipe, *block);
+		if (next == NULL) {
+			return -1;
+		}
+		if (*block != NULL) {
+			memory_free(MEMORY_SCRATCH, (*block)->bytes);
+			(*block)->bytes = NULL;
+		}
+		*block = next;
+	}
+	const char* cursor = (*block)->bytes + (*block)->start;
+	buffer_read_line(&cursor, (*block)->bytes + (*block)->size, line);
+	(*block)->start = cursor - (*block)->bytes;
+	return 0;
+}
+
+
+/**
+ * Parse and resolve the edge lines of a block, counting the inlinks and outlinks of every page
+ * @param block, the block, whose bytes are freed
+ * @param table, the hash table of the page names
+ * @param inlinks, the inlinks of each page, added to atomically
+ * @param outlinks, the outlinks of each page, added to atomically
+ * @return 0 on success, otherwise -1 if a line is invalid or an allocation fails
+ */
+static int pipeline_parse(struct pipeline_block* block, const struct name_table* table, int* inlinks, int* outlinks) {
+	char buffer[LONG_LINE_SIZE];
+	char src_name[LONG_NAME_SIZE];
+	char dst_name[LONG_NAME_SIZE];
+	char rest[LONG_LINE_SIZE];
+	const char* c = block->bytes + block->start;
+	const char* end = block->bytes + block->size;
+	block->sources = memory_malloc(MEMORY_SCRATCH, sizeof(int) * block->nedges);
+	block->targets = memory_malloc(MEMORY_SCRATCH, sizeof(int) * block->nedges);
+	int failed = block->sources == NULL || block->targets == NULL;
+	for (int e = 0; e < block->nedges && !failed; e++) {
+		buffer_read_line(&c, end, buffer);
+		int src = -1;
+		int dst = -1;
+		if (sscanf(buffer, long_names ? "%100s %100s %s\n" : "%20s %20s %s\n", src_name, dst_name, rest) == 2) {
+			src = name_table_find(table, src_name);
+			dst = name_table_find(table, dst_name);
+		}
+		failed = src < 0 || dst < 0;
+		if (!failed) {
+			block->sources[e] = src;
+			block->targets[e] = dst;
+			#pragma omp atomic
+			inlinks[dst]++;
+			#pragma omp atomic
+			outlinks[src]++;
+		}
+	}
+	memory_free(MEMORY_SCRATCH, block->bytes);
+	block->bytes = NULL;
+	return failed ? -1 : 0;
+}
+
+
+/**
+ * Build the graph from a stream in the same format as read_input while it is still being read
+ * A reader thread reads the stream in blocks of PIPELINE_BLOCK bytes cut at the last newline.
+ * The pages are added serially to the list and a hash table as their blocks arrive, then each
+ * block of edge lines is handed to a task that parses and resolves its lines and counts the
+ * inlinks and outlinks of every page, while the next block is read. Once every edge has been
+ * counted, prefix sums give the csr offsets and each thread scatters the edges of its range of
+ * pages into the csr in the order read_input would build the inlink lists.
+ * @param stream, the stream to read
+ * @param plist, set to the list of pages, left for the caller to destroy even on failure
+ * @param ncores, set to the number of cores
+ * @param npages, set to the number of pages
+ * @param nedges, set to the number of edges
+ * @param dampener, set to the dampening effect
+ * @return the csr, or NULL if the input is invalid or a read or an allocation fails
+ */
+static struct csr* csr_load_pipelined(FILE* stream, list** plist, int* ncores, int* npages, int* nedges, double* dampener) {
+	struct pipeline pipe = {
+		.stream = stream,
+		.head = NULL,
+		.tail = NULL,
+		.done = 0,
+		.failed = 0,
+		.stop = 0,
+	};
+	pthread_mutex_init(&pipe.lock, NULL);
+	pthread_cond_init(&pipe.changed, NULL);
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, pipeline_reader_run, &pipe) != 0) {
+		pthread_mutex_destroy(&pipe.lock);
+		pthread_cond_destroy(&pipe.changed);
+		return NULL;
+	}
+
+	char line[LONG_LINE_SIZE];
+	char name1[LONG_NAME_SIZE];
+	char excess[LONG_LINE_SIZE];
+	struct pipeline_block* block = NULL;
+	int failed = pipeline_read_line(&pipe, &block, line) != 0 || sscanf(line, "%d\n", ncores) != 1 || *ncores == 0
+		|| pipeline_read_line(&pipe, &block, line) != 0 || sscanf(line, "%lf\n", dampener) != 1
+		|| *dampener < 0 || fabs(*dampener) > 1
+		|| pipeline_read_line(&pipe, &block, line) != 0 || sscanf(line, "%d\n", npages) != 1 || *npages == 0;
+	int nthreads = !failed && *ncores > 0 ? *ncores : 1;
+	int n = !failed && *npages > 0 ? *npages : 0;
+
+	// Pages go into the list and name table in order, with long names cut short in the page list
+	page** pages = memory_malloc(MEMORY_PAGES, sizeof(page*) * (n > 0 ? n : 1));
+	struct name_table table = { 1, NULL, string_table_create(n) };
+	while (table.capacity < 2 * n) {
+		table.capacity *= 2;
+	}
+	table.slots = memory_malloc(MEMORY_NAMES, sizeof(int) * table.capacity);
+	failed = failed || (*plist = page_list_create()) == NULL || pages == NULL || table.slots == NULL || table.names == NULL;
+	if (!failed) {
+		memset(table.slots, -1, sizeof(int) * table.capacity);
+	}
+	for (int i = 0; i < n && !failed; i++) {
+		page* p = NULL;
+		failed = pipeline_read_line(&pipe, &block, line) != 0
+			|| sscanf(line, long_names ? "%100s\n" : "%20s\n", name1) != 1 || name_table_add(&table, name1) != i;
+		if (!failed) {
+			name1[NAME_SIZE - 1] = '\0';
+			failed = (p = page_create(name1, i)) == NULL || page_list_add_end(*plist, p) == NULL;
+		}
+		if (!failed) {
+			pages[i] = p;
+		} else {
+			page_destroy(p);
+		}
+	}
+	failed = failed || pipeline_read_line(&pipe, &block, line) != 0 || sscanf(line, "%d %s\n", nedges, excess) != 1;
+
+	int m = failed || *nedges < 0 ? 0 : *nedges;
+	int* degrees = memory_calloc(MEMORY_SCRATCH, 2 * (size_t)n + 1, sizeof(int));	// inlinks then outlinks
+	struct csr* graph = memory_calloc(MEMORY_PAGES, 1, sizeof(struct csr));
+	if (graph != NULL) {
+		graph->offsets = memory_calloc(MEMORY_PAGES, n + 1, sizeof(int));
+		graph->sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (m > 0 ? m : 1));
+		graph->inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * (n > 0 ? n : 1));
+	}
+	failed = failed || degrees == NULL || graph == NULL || graph->offsets == NULL || graph->sources == NULL
+		|| graph->inv_outlinks == NULL;
+
+	// Count the lines of each block as it arrives and parse it in a task while waiting for the next
+	long lines = 0;
+	if (!failed) {
+		#pragma omp parallel num_threads(nthreads)
+		#pragma omp single
+		{
+			struct pipeline_block* b = block;
+			while (b != NULL) {
+				long count = 0;
+				const char* end = b->bytes + b->size;
+				for (const char* c = b->bytes + b->start; c < end; count++) {
+					const char* newline = memchr(c, '\n', end - c);
+					c = newline != NULL ? newline + 1 : end;
+				}
+				b->nedges = count < m - lines ? (int)count : (int)(m - lines);
+				lines += count;
+				if (b->nedges > 0) {
+					#pragma omp task firstprivate(b)
+					if (pipeline_parse(b, &table, degrees, degrees + n) != 0) {
+						#pragma omp atomic write
+						failed = 1;
+					}
+				}
+				b = lines < m ? pipeline_next(&pipe, b) : NULL;
+			}
+		}
+	}
+
+	// The reader may still be reading input past the edges, which read_input would ignore
+	pthread_mutex_lock(&pipe.lock);
+	pipe.stop = 1;
+	pthread_mutex_unlock(&pipe.lock);
+	pthread_join(thread, NULL);
+	failed = failed || pipe.failed || lines < m;
+
+	if (!failed) {
+		// Prefix sums of the inlinks of each page, the inlinks become the end of each page's slots
+		int total = 0;
+		for (int i = 0; i < n; i++) {
+			graph->offsets[i] = total;
+			total += degrees[i];
+			degrees[i] = total;
+			pages[i]->noutlinks = degrees[n + i];
+			graph->inv_outlinks[i] = degrees[n + i] > 0 ? 1.0 / (double)degrees[n + i] : 0.0;
+		}
+		graph->offsets[n] = total;
+		graph->npages = n;
+		graph->nedges = m;
+
+		// Scatter from the back so each page's inlinks are newest first like page_list_add_front
+		#pragma omp parallel num_threads(nthreads)
+		{
+			int t = omp_get_thread_num();
+			int team = omp_get_num_threads();
+			int first = (int)((long)n * t / team);
+			int last = (int)((long)n * (t + 1) / team);
+			for (struct pipeline_block* b = pipe.head; b != NULL; b = b->next) {
+				for (int e = 0; e < b->nedges; e++) {
+					int dst = b->targets[e];
+					if (dst >= first && dst < last) {
+						graph->sources[--degrees[dst]] = b->sources[e];
+					}
+				}
+			}
+		}
+
+		failed = csr_build_inlink_lists(graph, pages, nthreads) != 0;
+	}
+
+	while (pipe.head != NULL) {
+		struct pipeline_block* next = pipe.head->next;
+		memory_free(MEMORY_SCRATCH, pipe.head->bytes);
+		memory_free(MEMORY_SCRATCH, pipe.head->sources);
+		memory_free(MEMORY_SCRATCH, pipe.head->targets);
+		memory_free(MEMORY_SCRATCH, pipe.head);
+		pipe.head = next;
+	}
+	pthread_mutex_destroy(&pipe.lock);
+	pthread_cond_destroy(&pipe.changed);
+	memory_free(MEMORY_SCRATCH, degrees);
+	memory_free(MEMORY_NAMES, table.slots);
+	if (graph != NULL) {
+		graph->pages = pages;
+		graph->names = table.names;
+		pages = NULL;
+		table.names = NULL;
+	}
+	memory_free(MEMORY_PAGES, pages);
+	string_table_destroy(table.names);
+	if (failed) {
+		csr_destroy(graph);
+		return NULL;
+	}
+	return graph;
+}
+
+
+/**
+ * Read the input in the same format as read_input, building the graph with ncores threads
+ * The whole of stdin is read into memory and built with csr_load, or with -P built with
+ * csr_load_pipelined while it is read. The csr is kept for the csr kernels to use instead of
+ * rebuilding it.
+ * die() is called if there are any input errors
+ */
+void read_input_parallel(list** plist, int* ncores, int* npages, int* nedges, double* dampener) {
+	if (external_dir != NULL) {
+		read_input_external(plist, ncores, npages, nedges, dampener);
+		return;
+	}
+
+	if (pipeline_input) {
+		if ((loaded_graph = csr_load_pipelined(stdin, plist, ncores, npages, nedges, dampener)) == NULL) {
+			die(*plist);
+		}
+		return;
+	}
+
+	size_t size;
+	char* input = read_stream(stdin, &size);
+	if (input == NULL) {
+		die(*plist);
+	}
+	struct csr* graph = csr_load(input, size, plist, ncores, npages, nedges, dampener, NULL);
+	free(input);
+	if (graph == NULL) {
+		die(*plist);
+	}
+	loaded_graph = graph;
+}
+
+
+/**
+ * Parse a pair of counts e.g. "1000000,10000000"
+ * @param arg, the pair to parse
+ * @param first, set to the first count
+ * @param second, set to the second count
+ * @return 0 on success, otherwise -1 if the pair is invalid
+ */
+int parse_pair(const char* arg, int* first, int* second) {
+	char* end;
+	long a = strtol(arg, &end, 10);
+	if (end == arg || *end != ',') {
+		return -1;
+	}
+	const char* rest = end + 1;
+	long b = strtol(rest, &end, 10);
+	if (end == rest || *end != '\0' || a <= 0 || b < 0 || a > INT_MAX || b > INT_MAX) {
+		return -1;
+	}
+	*first = (int)a;
+	*second = (int)b;
+	return 0;
+}
+
+
+/**
+ * Parse a comma separated list of dampening effects e.g. "0.5,0.85,0.9"
+ * @param arg, the list to parse
+ * @param dampeners, the array to fill (MAX_DAMPENERS long)
+ * @return the number of dampening effects read, or -1 if the list is invalid
+ */
+int parse_dampeners(const char* arg, double* dampeners) {
+	int count = 0;
+	const char* cursor = arg;
+	while (*cursor != '\0') {
+		char* end;
+		double value = strtod(cursor, &end);
+		if (end == cursor || count == MAX_DAMPENERS || value <= 0 || value > 1) {
+			return -1;
+		}
+		dampeners[count++] = value;
+		if (*end == ',') {
+			end++;
+		} else if (*end != '\0') {
+			return -1;
+		}
+		cursor = end;
+	}
+	return count > 0 ? count : -1;
+}
+
+
+typedef void (*pagerank_kernel)(list* plist, int ncores, int npages, int nedges, double dampener);
+
+
+/**
+ * The kernels that can be picked from the command line
+ */
+static const struct {
+	const char* name;
+	pagerank_kernel run;
+	int method;		// the CSR_ method of a kernel ranking from the csr, otherwise -1
+} kernels[] = {
+	{ "pagerank", pagerank, -1 },
+	{ "unroll", pagerank_unroll, -1 },
+	{ "nopow", pagerank_nopow, -1 },
+	{ "pow", pagerank_pow, -1 },
+	{ "pow_old", pagerank_pow_old, -1 },
+	{ "padding", pagerank_padding, -1 },
+	{ "mm", pagerank_mm, -1 },
+	{ "push", pagerank_push, CSR_PUSH },
+	{ "adaptive", pagerank_adaptive, CSR_ADAPTIVE },
+	{ "csr", pagerank_csr, CSR_PULL },
+	{ "blocked", pagerank_blocked, CSR_BLOCKED },
+	{ "balanced", pagerank_balanced, CSR_BALANCED },
+	{ "balanced_split", pagerank_balanced_split, CSR_BALANCED_SPLIT },
+	{ "steal", pagerank_steal, CSR_STEAL },
+	{ "float", pagerank_float, CSR_FLOAT },
+	{ "mixed", pagerank_mixed, CSR_MIXED },
+	{ "compressed", pagerank_compressed, CSR_COMPRESSED },
+	{ "aitken", pagerank_aitken, CSR_AITKEN },
+	{ "quadratic", pagerank_quadratic, CSR_QUADRATIC },
+	{ "bicgstab", pagerank_bicgstab, CSR_BICGSTAB },
+	{ "gmres", pagerank_gmres, CSR_GMRES },
+	{ "scc", pagerank_scc, CSR_SCC },
+	{ "edge", pagerank_edge, CSR_EDGE },
+	{ "montecarlo", pagerank_montecarlo, CSR_MONTE_CARLO },
+	{ "sharded", pagerank_sharded, CSR_SHARDED },
+	{ "weighted", pagerank_weighted, CSR_WEIGHTED },
+	{ "external", pagerank_external, -1 },
+};
+
+
+/**
+ * Find a kernel by name
+ * @param name, the name of the kernel
+ * @param method, set to the CSR_ method of the kernel, or -1 if it ranks from the page list
+ * @return the kernel, or NULL if there is no kernel with that name
+ */
+pagerank_kernel find_kernel(const char* name, int* method) {
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		if (strcmp(kernels[i].name, name) == 0) {
+			*method = kernels[i].method;
+			return kernels[i].run;
+		}
+	}
+	return NULL;
+}
+
+
+/* the kernel run under -m, which reports the memory held by each subsystem at exit */
+static pagerank_kernel measured_kernel = NULL;
+
+
+/**
+ * Count the page list a loader built against pages and edges, as it is allocated in pagerank.h
+ * @param plist, the list of pages
+ */
+static void memory_add_list(list* plist) {
+	long pages = (long)malloc_usable_size(plist);
+	long edges = 0;
+	for (node* current = plist->head; current != NULL; current = current->next) {
+		pages += (long)(malloc_usable_size(current) + malloc_usable_size(current->page));
+		list* inlinks = current->page->inlinks;
+		if (inlinks != NULL) {
+			edges += (long)malloc_usable_size(inlinks);
+			for (node* link = inlinks->head; link != NULL; link = link->next) {
+				edges += (long)malloc_usable_size(link);
+			}
+		}
+	}
+	memory_add(MEMORY_PAGES, pages);
+	memory_add(MEMORY_EDGES, edges);
+}
+
+
+/**
+ * PageRank algorithm of the kernel picked with -k, counting the page list first
+ * Given a list of pages calculate the ranking of the pages using a dampening effect
+ * @param plist, list of pages
+ * @param ncores, number of cores
+ * @param npages, number of pages
+ * @param nedges, number of edges
+ * @param dampener, the dampening effect on the pages
+ */
+void pagerank_measured(list* plist, int ncores, int npages, int nedges, double dampener) {
+	if (plist != NULL) {
+		memory_add_list(plist);
+	}
+	measured_kernel(plist, ncores, npages, nedges, dampener);
+}
+
+
+/**
+ * Print the most bytes each subsystem held, the most held at once and the peak resident set size
+ */
+static void memory_report(void) {
+	struct rusage usage;
+	long rss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss * 1024L : -1;
+	fprintf(stderr, "memory");
+	for (int kind = 0; kind < MEMORY_KINDS; kind++) {
+		fprintf(stderr, " %s %ld", memory_kind_names[kind], atomic_load(&memory_peak[kind]));
+	}
+	fprintf(stderr, " tracked %ld rss %ld\n", atomic_load(&memory_peak[MEMORY_KINDS]), rss);
+}
+
+
+/**
+ * Size of the chunk malloc hands out for a request
+ */
+static long memory_chunk(long size) {
+	long chunk = (size + (long)sizeof(size_t) + 15) & ~15L;
+	return chunk < 32 ? 32 : chunk;
+}
+
+
+/**
+ * Estimate the bytes each subsystem holds at its peak while a kernel ranks a graph, before reading it
+ * Counts every array the loader and the kernel allocate in proportion to the graph, taking names
+ * as NAME_SIZE bytes each and every page as having inlinks.
+ * @param kernel, the index of the kernel in kernels
+ * @param n, the number of pages
+ * @param m, the number of edges
+ * @param ncores, number of cores
+ * @param parallel_read, whether the graph is read with read_input_parallel
+ * @param bytes, filled with the bytes of each MEMORY_ subsystem
+ */
+static void memory_estimate(int kernel, long n, long m, int ncores, int parallel_read, long* bytes) {
+	pagerank_kernel run = kernels[kernel].run;
+	int method = kernels[kernel].method;
+	long slots = 1;
+	while (slots < 2 * n) {
+		slots *= 2;
+	}
+	long names = n * ((long)sizeof(size_t) + NAME_SIZE);
+	memset(bytes, 0, sizeof(long) * MEMORY_KINDS);
+
+	// Every loader keeps the pages in the list, the external one without their inlinks
+	bytes[MEMORY_PAGES] = memory_chunk(sizeof(list)) + n * (memory_chunk(sizeof(node)) + memory_chunk(sizeof(page)));
+	if (run == pagerank_external) {
+		long chunk = m < EXTERNAL_CHUNK_EDGES ? m : EXTERNAL_CHUNK_EDGES;
+		bytes[MEMORY_PAGES] += n * (long)(sizeof(long) + sizeof(double) + sizeof(int));
+		bytes[MEMORY_EDGES] = 2 * chunk * (long)sizeof(int);
+		bytes[MEMORY_NAMES] = names + slots * (long)sizeof(int);
+		bytes[MEMORY_SCORES] = 2 * n * (long)sizeof(double);
+		bytes[MEMORY_SCRATCH] = 3 * (m < EXTERNAL_BUCKET_EDGES ? m : EXTERNAL_BUCKET_EDGES) * (long)sizeof(int);
+		return;
+	}
+	bytes[MEMORY_EDGES] = m * memory_chunk(sizeof(node)) + (n < m ? n : m) * memory_chunk(sizeof(list));
+
+	// The parallel loader builds the csr too, keeping it for the csr kernels
+	if (parallel_read) {
+		bytes[MEMORY_NAMES] += slots * (long)sizeof(int);
+		bytes[MEMORY_SCRATCH] = 2 * m * (long)sizeof(int) + 2 * n * ncores * (long)sizeof(int);
+	}
+	if (parallel_read || method >= 0) {
+		bytes[MEMORY_PAGES] += n * (long)(sizeof(int) + sizeof(double) + sizeof(page*));
+		bytes[MEMORY_EDGES] += m * (long)sizeof(int);
+		bytes[MEMORY_NAMES] += names;
+		if (reorder_method != REORDER_NONE) {
+			bytes[MEMORY_PAGES] += n * (long)sizeof(int);
+		}
+	}
+
+	long vector = n * (long)sizeof(double);
+	long scratch = 0;
+	if (run == pagerank) {
+		bytes[MEMORY_SCORES] = n * (long)sizeof(struct page_score);
+		scratch = n * (long)sizeof(page*);
+	} else if (run == pagerank_unroll || run == pagerank_nopow || run == pagerank_pow) {
+		bytes[MEMORY_SCORES] = n * (long)sizeof(struct page_score);
+	} else if (run == pagerank_pow_old) {
+		bytes[MEMORY_SCORES] = n * (long)sizeof(struct page_score_2D);
+	} else if (run == pagerank_padding) {
+		bytes[MEMORY_SCORES] = n * (long)sizeof(struct page_score_padding);
+	} else if (run == pagerank_mm) {
+		bytes[MEMORY_SCORES] = 2 * vector;
+		scratch = n * vector;
+	} else {
+		// The scores printed, and the second vector most methods iterate with
+		bytes[MEMORY_SCORES] = 2 * vector;
+	}
+
+	if (method == CSR_BLOCKED) {
+		bytes[MEMORY_EDGES] += 3 * m * (long)sizeof(int);
+		scratch = 2 * vector;
+	} else if (method == CSR_FLOAT || method == CSR_MIXED) {
+		scratch = vector;
+	} else if (method == CSR_COMPRESSED) {
+		// No gap takes more bytes than the largest page index, and up to 4 bytes they overwrite the csr
+		long varint = 1;
+		for (long v = n; v >= 0x80; v >>= 7) {
+			varint++;
+		}
+		bytes[MEMORY_EDGES] += n * (long)sizeof(size_t) + (varint > (long)sizeof(int) ? varint * m : 0);
+		scratch = (m < n * ncores ? m : n * ncores) * (long)sizeof(int);
+	} else if (method == CSR_AITKEN || method == CSR_QUADRATIC) {
+		bytes[MEMORY_SCORES] = vector;
+		scratch = 5 * vector;
+	} else if (method == CSR_BICGSTAB) {
+		bytes[MEMORY_SCORES] = vector;
+		scratch = 8 * vector;
+	} else if (method == CSR_GMRES) {
+		bytes[MEMORY_SCORES] = vector;
+		scratch = (GMRES_RESTART + 3) * vector;
+	} else if (method == CSR_SCC || method == CSR_PUSH || method == CSR_ADAPTIVE || method == CSR_MONTE_CARLO) {
+		// The outlinks are built alongside the inlinks
+		bytes[MEMORY_PAGES] += n * (long)sizeof(int);
+		bytes[MEMORY_EDGES] += m * (long)sizeof(int);
+		if (method == CSR_SCC) {
+			scratch = 11 * n * (long)sizeof(int);
+		} else if (method == CSR_MONTE_CARLO) {
+			bytes[MEMORY_SCORES] = vector;
+			scratch = n * ncores * (long)sizeof(long);
+		} else {
+			// Pending changes, one accumulator per core, the active and touched lists and the claims
+			scratch = vector * (1 + ncores) + n * (2 * (long)sizeof(int) + 1);
+		}
+	} else if (method == CSR_EDGE) {
+		long part_pages = block_pages() / ncores;
+		part_pages = part_pages > 1024 ? part_pages : 1024;
+		bytes[MEMORY_EDGES] += m * (long)sizeof(struct edge);
+		part_pages = part_pages < n ? part_pages : n;
+		long nparts = (n + part_pages - 1) / part_pages;
+		scratch = vector + part_pages * (ncores < nparts ? ncores : nparts) * (long)sizeof(double);
+	} else if (method == CSR_SHARDED) {
+		scratch = n;
+	} else if (method == CSR_WEIGHTED) {
+		// As many weights as inlinks, before repeats are merged
+		bytes[MEMORY_EDGES] += m * (long)sizeof(int);
+		scratch = 2 * n * (long)sizeof(int);
+	}
+	if (scratch > bytes[MEMORY_SCRATCH]) {
+		bytes[MEMORY_SCRATCH] = scratch;
+	}
+}
+
+
+/**
+ * Print the estimated footprint of every kernel for a graph of the given size
+ * @param npages, the number of pages
+ * @param nedges, the number of edges
+ * @param parallel_read, whether the graph would be read with read_input_parallel
+ */
+static void memory_print_estimates(int npages, int nedges, int parallel_read) {
+	int ncores = omp_get_num_procs();
+	for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+		long bytes[MEMORY_KINDS];
+		memory_estimate((int)i, npages, nedges, ncores, parallel_read, bytes);
+		long total = 0;
+		printf("%-15s", kernels[i].name);
+		for (int kind = 0; kind < MEMORY_KINDS; kind++) {
+			printf(" %s %ld", memory_kind_names[kind], bytes[kind]);
+			total += bytes[kind];
+		}
+		printf(" total %ld\n", total);
+	}
+}
+
+
+/**
+ * A graph loaded through the library interface, kept resident between rankings
+ */
+struct pagerank_graph {
+	list* plist;		// NULL for graphs made by pagerank_graph_apply
+	struct csr* graph;
+	struct name_table names;	// finds pages by name, its string table is the csr's
+	int ncores;		// from the input, used unless a ranking picks its own
+	double dampener;
+	double* scores;		// of the last ranking in input order, NULL until ranked
+};
+
+
+/**
+ * Put the settings main reads from its options back to their defaults
+ * The library shares them with main, which a host may also call, so they are reset on every entry
+ * that loads or ranks. This is why loading and ranking are not reentrant.
+ */
+static void options_reset(void) {
+	pin_threads = 0;
+	deterministic_sums = 0;
+	pipeline_input = 0;
+	external_dir = NULL;
+	long_names = 0;
+	reorder_method = REORDER_NONE;
+	budget_seconds = 0;
+	budget_error = 0;
+	coalesce_edges = COALESCE_NONE;
+	block_cache_bytes = 0;
+	monte_carlo_walks = 0;
+	shard_count = 0;
+}
+
+
+/**
+ * Load a graph from input held in memory
+ * @param buffer, the input in the same format as read_input
+ * @param size, the length of the input in bytes
+ * @return the graph, or NULL if the input is invalid or an allocation fails
+ */
+pagerank_graph* pagerank_graph_load_buffer(const char* buffer, size_t size) {
+	if (buffer == NULL) {
+		return NULL;
+	}
+	options_reset();
+	pagerank_graph* handle = calloc(1, sizeof(pagerank_graph));
+	if (handle == NULL) {
+		return NULL;
+	}
+	int npages, nedges;
+	if ((handle->graph = csr_load(buffer, size, &handle->plist, &handle->ncores, &npages, &nedges,
+			&handle->dampener, &handle->names)) == NULL) {
+		pagerank_graph_destroy(handle);
+		return NULL;
+	}
+	return handle;
+}
+
+
+/**
+ * Load a graph from an input file
+ * @param path, the file in the same format as read_input
+ * @return the graph, or NULL if the file cannot be read, is invalid or an allocation fails
+ */
+pagerank_graph* pagerank_graph_load_file(const char* path) {
+	FILE* file = path != NULL ? fopen(path, "r") : NULL;
+	if (file == NULL) {
+		return NULL;
+	}
+	size_t size;
+	char* input = read_stream(file, &size);
+	int failed = ferror(file);
+	fclose(file);
+	pagerank_graph* handle = input != NULL && !failed ? pagerank_graph_load_buffer(input, size) : NULL;
+	free(input);
+	return handle;
+}
+
+
+/**
+ * Clean up a graph loaded through the library interface
+ * @param handle, the graph to free
+ */
+void pagerank_graph_destroy(pagerank_graph* handle) {
+	if (handle == NULL) {
+		return;
+	}
+	csr_destroy(handle->graph);
+	page_list_destroy(handle->plist);
+	memory_free(MEMORY_NAMES, handle->names.slots);
+	memory_free(MEMORY_SCORES, handle->scores);
+	free(handle);
+}
+
+
+/**
+ * Copy a graph with some edges added and others removed
+ * The pages stay the same, so page indices and names carry over to the new graph. Added
+ * edges come first in the inlinks of their target, newest first like read_input, ahead of
+ * the inlinks kept from the graph.
+ * @param handle, the graph to copy, left unchanged
+ * @param added, the edges to add
+ * @param nadded, the number of edges to add
+ * @param removed, the edges to remove, each removing one of any repeats of that edge
+ * @param nremoved, the number of edges to remove
+ * @return the new graph, or NULL if an edge is invalid, a removed edge is not in the graph
+ *     or an allocation fails
+ */
+pagerank_graph* pagerank_graph_apply(const pagerank_graph* handle, const struct pagerank_edge* added, int nadded,
+		const struct pagerank_edge* removed, int nremoved) {
+	if (handle == NULL || nadded < 0 || nremoved < 0 || (nadded > 0 && added == NULL) || (nremoved > 0 && removed == NULL)) {
+		return NULL;
+	}
+	const struct csr* old = handle->graph;
+	int n = old->npages;
+	for (int k = 0; k < nadded; k++) {
+		if (added[k].source < 0 || added[k].source >= n || added[k].target < 0 || added[k].target >= n) {
+			return NULL;
+		}
+	}
+	for (int k = 0; k < nremoved; k++) {
+		if (removed[k].source < 0 || removed[k].source >= n || removed[k].target < 0 || removed[k].target >= n) {
+			return NULL;
+		}
+	}
+
+	int m = old->offsets[n] + nadded - nremoved;
+	pagerank_graph* copy = calloc(1, sizeof(pagerank_graph));
+	struct csr* graph = memory_calloc(MEMORY_PAGES, 1, sizeof(struct csr));
+	char* dropped = calloc(old->offsets[n] > 0 ? old->offsets[n] : 1, 1);
+	int* fill = malloc(sizeof(int) * n);
+	if (copy != NULL) {
+		copy->graph = graph;
+		copy->names.capacity = handle->names.capacity;
+		copy->names.slots = memory_malloc(MEMORY_NAMES, sizeof(int) * handle->names.capacity);
+	}
+	if (graph != NULL) {
+		graph->npages = n;
+		graph->nedges = m;
+		graph->offsets = memory_calloc(MEMORY_PAGES, n + 1, sizeof(int));
+		graph->sources = memory_malloc(MEMORY_EDGES, sizeof(int) * (m > 0 ? m : 1));
+		graph->inv_outlinks = memory_malloc(MEMORY_PAGES, sizeof(double) * n);
+		graph->names = string_table_create(n);
+	}
+	int failed = copy == NULL || graph == NULL || dropped == NULL || fill == NULL || copy->names.slots == NULL
+		|| graph->offsets == NULL || graph->sources == NULL || graph->inv_outlinks == NULL || graph->names == NULL;
+	for (int i = 0; i < n && !failed; i++) {
+		failed = string_table_add(graph->names, string_table_get(old->names, i)) != i;
+	}
+
+	// Drop one kept inlink for each removed edge
+	for (int k = 0; k < nremoved && !failed; k++) {
+		int e = old->offsets[removed[k].target];
+		while (e < old->offsets[removed[k].target + 1] && (dropped[e] || old->sources[e] != removed[k].source)) {
+			e++;
+		}
+		failed = e == old->offsets[removed[k].target + 1];
+		if (!failed) {
+			dropped[e] = 1;
+		}
+	}
+
+	if (!failed) {
+		memcpy(copy->names.slots, handle->names.slots, sizeof(int) * handle->names.capacity);
+		copy->names.names = graph->names;
+		copy->ncores = handle->ncores;
+		copy->dampener = handle->dampener;
+
+		// Count the inlinks of each page then fill added edges newest first ahead of the kept ones
+		for (int i = 0; i < n; i++) {
+			graph->offsets[i + 1] = old->offsets[i + 1] - old->offsets[i];
+		}
+		for (int k = 0; k < nremoved; k++) {
+			graph->offsets[removed[k].target + 1]--;
+		}
+		for (int k = 0; k < nadded; k++) {
+			graph->offsets[added[k].target + 1]++;
+		}
+		for (int i = 0; i < n; i++) {
+			graph->offsets[i + 1] += graph->offsets[i];
+			fill[i] = graph->offsets[i];
+		}
+		for (int k = nadded - 1; k >= 0; k--) {
+			graph->sources[fill[added[k].target]++] = added[k].source;
+		}
+		for (int i = 0; i < n; i++) {
+			for (int e = old->offsets[i]; e < old->offsets[i + 1]; e++) {
+				if (!dropped[e]) {
+					graph->sources[fill[i]++] = old->sources[e];
+				}
+			}
+		}
+
+		// Outlinks are counted again from the sources
+		memset(fill, 0, sizeof(int) * n);
+		for (int e = 0; e < m; e++) {
+			fill[graph->sources[e]]++;
+		}
+		for (int i = 0; i < n; i++) {
+			graph->inv_outlinks[i] = fill[i] > 0 ? 1.0 / (double)fill[i] : 0.0;
+		}
+	}
+
+	free(dropped);
+	free(fill);
+	if (failed) {
+		pagerank_graph_destroy(copy);
+		if (copy == NULL) {
+			csr_destroy(graph);
+		}
+		return NULL;
+	}
+	return copy;
+}
+
+
+/**
+ * Find a page of a graph by name
+ * @param handle, the graph
+ * @param name, the name of the page
+ * @return the index of the first page with that name in input order, or -1 if there is none
+ */
+int pagerank_graph_find(const pagerank_graph* handle, const char* name) {
+	if (handle == NULL || name == NULL) {
+		return -1;
+	}
+	return name_table_find(&handle->names, name);
+}
+
+
+/**
+ * Rank a loaded graph with one of the csr kernels, keeping the scores in the graph
+ * This is not reentrant: rankings share the process-wide kernel settings, so no two graphs may be
+ * ranked or loaded from two threads at once. Those settings are reset to their defaults first.
+ * @param handle, the graph
+ * @param options, the kernel, number of cores and dampening effect, NULL for the defaults
+ * @return 0 on success, otherwise -1 if an option is invalid or an allocation fails
+ */
+int pagerank_graph_rank(pagerank_graph* handle, const struct pagerank_run_options* options) {
+	struct pagerank_run_options defaults = { NULL, 0, 0.0 };
+	if (options == NULL) {
+		options = &defaults;
+	}
+	options_reset();
+	int method = CSR_PULL;
+	if (handle == NULL || (options->kernel != NULL
+			&& (find_kernel(options->kernel, &method) == NULL || method < 0))) {
+		return -1;
+	}
+	int ncores = options->ncores > 0 ? options->ncores : handle->ncores;
+	double dampener = options->dampener > 0 ? options->dampener : handle->dampener;
+	if (ncores <= 0 || dampener <= 0 || dampener > 1) {
+		return -1;
+	}
+
+	if (handle->scores == NULL && (handle->scores = memory_malloc(MEMORY_SCORES, sizeof(double) * handle->graph->npages)) == NULL) {
+		return -1;
+	}
+	if (csr_run(handle->graph, ncores, dampener, method, handle->scores) != 0) {
+		memory_free(MEMORY_SCORES, handle->scores);
+		handle->scores = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+
+/**
+ * @param handle, the graph
+ * @return the number of pages of the graph
+ */
+int pagerank_graph_npages(const pagerank_graph* handle) {
+	return handle != NULL ? handle->graph->npages : 0;
+}
+
+
+/**
+ * @param handle, the graph
+ * @return the number of edges of the graph
+ */
+int pagerank_graph_nedges(const pagerank_graph* handle) {
+	return handle != NULL ? handle->graph->nedges : 0;
+}
+
+
+/**
+ * @param handle, the graph
+ * @return the dampening effect of the input, used unless a ranking picks its own
+ */
+double pagerank_graph_dampener(const pagerank_graph* handle) {
+	return handle != NULL ? handle->dampener : 0.0;
+}
+
+
+/**
+ * @param handle, the graph
+ * @param index, the index of the page in input order
+ * @return the name of the page, or NULL if there is no such page
+ */
+const char* pagerank_graph_name(const pagerank_graph* handle, int index) {
+	if (handle == NULL || index < 0 || index >= handle->graph->npages) {
+		return NULL;
+	}
+	return string_table_get(handle->graph->names, index);
+}
+
+
+/**
+ * @param handle, the graph
+ * @return the scores of the last ranking in input order, or NULL if the graph has not been ranked
+ */
+const double* pagerank_graph_scores(const pagerank_graph* handle) {
+	return handle != NULL ? handle->scores : NULL;
+}
+
+
+/**
+ * The options read from the command line
+ */
+struct pagerank_options {
+	pagerank_kernel kernel;			// kernel to rank with
+	double dampeners[MAX_DAMPENERS];	// batch dampening effects, used instead of the input one
+	int ndampeners;
+	int generate_pages;			// generate a graph of this many pages instead of reading one
+	int generate_edges;
+	int parallel_read;			// build the graph with read_input_parallel
+	int estimate_pages;			// print the memory estimates for a graph of this many pages and exit
+	int estimate_edges;
+	int memory_report;			// report the memory held by each subsystem at exit
+	int csr;				// the kernel ranks from the csr
+	int method;				// CSR_ method of the kernel, or -1
+};
+
+
+/**
+ * Read the command line options
+ * @param argc, the number of arguments
+ * @param argv, the arguments
+ * @param options, the options to fill
+ * @return 0 on success, otherwise -1 if an option is invalid
+ */
+int parse_options(int argc, char** argv, struct pagerank_options* options) {
+	memset(options, 0, sizeof(struct pagerank_options));
+	options->kernel = pagerank;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:d:e:g:k:lmnpr:s:t:u:w:DE:M:P")) != -1) {
+		switch (opt) {
+			case 'k':
+				if ((options->kernel = find_kernel(optarg, &options->method)) == NULL) {
+					return -1;
+				}
+				options->csr = options->method >= 0;
+				break;
+			case 'd':
+				if ((options->ndampeners = parse_dampeners(optarg, options->dampeners)) < 0) {
+					return -1;
+				}
+				break;
+			case 'g':
+				if (parse_pair(optarg, &options->generate_pages, &options->generate_edges) != 0) {
+					return -1;
+				}
+				break;
+			case 'p':
+				pin_threads = 1;
+				break;
+			case 'D':
+				deterministic_sums = 1;
+				break;
+			case 'l':
+				options->parallel_read = 1;
+				break;
+			case 'P':
+				pipeline_input = 1;
+				options->parallel_read = 1;
+				break;
+			case 'm':
+				options->memory_report = 1;
+				break;
+			case 'M':
+				if (parse_pair(optarg, &options->estimate_pages, &options->estimate_edges) != 0) {
+					return -1;
+				}
+				break;
+			case 'e':
+				external_dir = optarg;
+				options->parallel_read = 1;
+				break;
+			case 'n':
+				long_names = 1;
+				break;
+			case 'r':
+				if (strcmp(optarg, "degree") == 0) {
+					reorder_method = REORDER_DEGREE;
+				} else if (strcmp(optarg, "rcm") == 0) {
+					reorder_method = REORDER_RCM;
+				} else if (strcmp(optarg, "gorder") == 0) {
+					reorder_method = REORDER_GORDER;
+				} else {
+					return -1;
+				}
+				break;
+			case 't':
+				if ((budget_seconds = atof(optarg)) <= 0) {
+					return -1;
+				}
+				break;
+			case 'E':
+				if ((budget_error = atof(optarg)) <= 0) {
+					return -1;
+				}
+				break;
+			case 'u':
+				if (strcmp(optarg, "keep") == 0) {
+					coalesce_edges = COALESCE_KEEP_LOOPS;
+				} else if (strcmp(optarg, "drop") == 0) {
+					coalesce_edges = COALESCE_DROP_LOOPS;
+				} else {
+					return -1;
+				}
+				break;
+			case 'c':
+				if ((block_cache_bytes = atol(optarg)) <= 0) {
+					return -1;
+				}
+				break;
+			case 'w':
+				if ((monte_carlo_walks = atoi(optarg)) <= 0) {
+					return -1;
+				}
+				break;
+			case 's':
+				if ((shard_count = atoi(optarg)) <= 0 || shard_count > MAX_SHARDS) {
+					return -1;
+				}
+				break;
+			default:
+				return -1;
+		}
+	}
+	if (optind != argc) {
+		return -1;
+	}
+
+	// Long names are only kept by the parallel loader and only printed by the csr and external kernels
+	int external = options->kernel == pagerank_external;
+	if (long_names && (!options->parallel_read || options->generate_pages > 0
+			|| (!options->csr && !external && options->ndampeners == 0))) {
+		return -1;
+	}
+
+	// The external loader leaves the pages without inlinks for every other kernel
+	if ((external_dir != NULL) != external || (external && (options->generate_pages > 0 || options->ndampeners > 0))) {
+		return -1;
+	}
+	if (pipeline_input && external_dir != NULL) {
+		return -1;
+	}
+
+	// Only the weighted kernel reads the weights, which it always ranks with
+	if (options->method == CSR_WEIGHTED && coalesce_edges == COALESCE_NONE) {
+		coalesce_edges = COALESCE_KEEP_LOOPS;
+	}
+	if (coalesce_edges != COALESCE_NONE && (options->method != CSR_WEIGHTED || options->ndampeners > 0)) {
+		return -1;
+	}
+
+	// Only the csr kernels relabel the pages, and only the kernels named read their own tuning
+	if (reorder_method != REORDER_NONE && !options->csr && options->ndampeners == 0) {
+		return -1;
+	}
+	if (block_cache_bytes > 0 && (options->ndampeners > 0 || (options->method != CSR_BLOCKED && options->method != CSR_EDGE))) {
+		return -1;
+	}
+	if (monte_carlo_walks > 0 && (options->ndampeners > 0 || options->method != CSR_MONTE_CARLO)) {
+		return -1;
+	}
+	if (shard_count > 0 && (options->ndampeners > 0 || options->method != CSR_SHARDED)) {
+		return -1;
+	}
+
+	// Only these kernels sum their residual in a fixed order
+	if (deterministic_sums && (options->ndampeners > 0 || (options->kernel != pagerank && options->kernel != pagerank_padding
+			&& options->method != CSR_PULL && options->method != CSR_WEIGHTED))) {
+		return -1;
+	}
+
+	// Only the kernels iterating the scores as they are stop on the budget
+	if ((budget_seconds > 0 || budget_error > 0) && (options->ndampeners > 0 || (options->kernel != pagerank
+			&& options->method != CSR_PULL && options->method != CSR_WEIGHTED))) {
+		return -1;
+	}
+
+	if (options->estimate_pages > 0) {
+		memory_print_estimates(options->estimate_pages, options->estimate_edges, options->parallel_read);
+		exit(0);
+	}
+	if (options->memory_report) {
+		measured_kernel = options->kernel;
+		options->kernel = pagerank_measured;
+		atexit(memory_report);
+	}
+	return 0;
+}
+
+
+/*
+######################################
+###      COMMAND LINE DRIVER       ###
+######################################
+*/
+
+int main(int argc, char** argv) {
+
+    /*
+    ######################################################
+    ### KEEP THE READ, TIME AND PRINT FLOW OF THE MAIN ###
+    ### FUNCTION, OPTIONS ONLY PICK THE LOADER/KERNEL  ###
+    ### DO NOT MODIFY THE HEADER FILE                  ###
+    ######################################################
+    */
+
+    list* plist = NULL;
+
+    double dampener;
+    int ncores, npages, nedges;
+    struct pagerank_options options;
+
+    if (parse_options(argc, argv, &options) != 0) {
+        fprintf(stderr, "usage: %s [-k kernel] [-d dampener,dampener,...] [-c cache_bytes] [-w walks] [-s shards] [-r degree|rcm|gorder] [-u keep|drop] [-t seconds] [-E error] [-p] [-D] [-m] [-M pages,edges] [-g pages,edges | [-l [-n] | -P [-n] | -e dir] < input]\n", argv[0]);
+        return 1;
+    }
+
+    /* read the input then populate settings and the list of pages */
+    if (options.generate_pages > 0) {
+        ncores = omp_get_num_procs();
+        dampener = 0.85;
+        npages = options.generate_pages;
+        nedges = options.generate_edges;
+        if (generate_graph(&plist, npages, nedges) != 0) {
+            die(plist);
+        }
+    } else if (options.parallel_read) {
+        read_input_parallel(&plist, &ncores, &npages, &nedges, &dampener);
+    } else {
+        read_input(&plist, &ncores, &npages, &nedges, &dampener);
+    }
 
     double start = omp_get_wtime();
-    pagerank(plist, ncores, npages, nedges, dampener);
+    if (options.ndampeners > 0) {
+        pagerank_batch(plist, ncores, npages, nedges, options.dampeners, options.ndampeners);
+    } else {
+        options.kernel(plist, ncores, npages, nedges, dampener);
+    }
     double end = omp_get_wtime();
     printf("%lf\n", end - start);
 
     /* clean up the memory used by the list of pages */
+    csr_destroy(loaded_graph);
     page_list_destroy(plist);
 
     return 0;
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "libpagerank.h"
+
+#define REQUEST_SIZE 4096	// longest request line, including the newline
+
+
+/**
+ * One ranking of a graph, never changed once published so queries can read it without copying
+ */
+struct snapshot {
+	pagerank_graph* graph;	// shared with the snapshot before it unless edges changed
+	double* scores;		// in input order
+	int* order;		// page indices by descending score
+	double dampener;
+	long generation;
+};
+
+
+/**
+ * A rerank or edge delta waiting for the updater
+ */
+struct update {
+	double dampener;		// new dampening effect, 0 to keep the current one
+	struct pagerank_edge* added;
+	int nadded;
+	struct pagerank_edge* removed;
+	int nremoved;
+	struct update* next;
+};
+
+
+static const char* kernel = NULL;	// kernel every ranking uses, NULL for "csr"
+
+// Published snapshot, only replaced by the updater while holding the write lock
+static pthread_rwlock_t snapshot_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct snapshot* current = NULL;
+
+// Updates run one at a time in order by the updater thread
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static struct update* queue_head = NULL;
+static struct update* queue_tail = NULL;
+static int npending = 0;
+static int stopping = 0;
+static int listener = -1;
+
+// Open connections, which the shutdown waits out before freeing the published snapshot
+struct client {
+	int fd;
+	struct client* next;
+};
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clients_done = PTHREAD_COND_INITIALIZER;
+static struct client* clients = NULL;
+static int nclients = 0;
+
+
+/**
+ * Clean up a snapshot, leaving its graph
+ */
+void snapshot_destroy(struct snapshot* snapshot) {
+	if (snapshot == NULL) {
+		return;
+	}
+	free(snapshot->scores);
+	free(snapshot->order);
+	free(snapshot);
+}
+
+
+/**
+ * Order pages by descending score, then by index
+ */
+static int compare_scores(const void* a, const void* b, void* scores) {
+	double x = ((const double*)scores)[*(const int*)a];
+	double y = ((const double*)scores)[*(const int*)b];
+	if (x != y) {
+		return x < y ? 1 : -1;
+	}
+	return *(const int*)a - *(const int*)b;
+}
+
+
+/**
+ * Rank a graph and copy the scores into a new snapshot
+ * The graph may be the one the published snapshot uses, since queries only read the names.
+ * @param graph, the graph to rank
+ * @param dampener, the dampening effect
+ * @param generation, the generation of the snapshot
+ * @return the snapshot, or NULL if ranking fails or an allocation fails
+ */
+struct snapshot* snapshot_create(pagerank_graph* graph, double dampener, long generation) {
+	struct pagerank_run_options options = { kernel, 0, dampener };
+	int npages = pagerank_graph_npages(graph);
+	struct snapshot* snapshot = calloc(1, sizeof(struct snapshot));
+	if (snapshot == NULL || pagerank_graph_rank(graph, &options) != 0
+			|| (snapshot->scores = malloc(sizeof(double) * npages)) == NULL
+			|| (snapshot->order = malloc(sizeof(int) * npages)) == NULL) {
+		snapshot_destroy(snapshot);
+		return NULL;
+	}
+	memcpy(snapshot->scores, pagerank_graph_scores(graph), sizeof(double) * npages);
+	for (int i = 0; i < npages; i++) {
+		snapshot->order[i] = i;
+	}
+	qsort_r(snapshot->order, npages, sizeof(int), compare_scores, snapshot->scores);
+	snapshot->graph = graph;
+	snapshot->dampener = dampener;
+	snapshot->generation = generation;
+	return snapshot;
+}
+
+
+/**
+ * Clean up an update
+ */
+void update_destroy(struct update* update) {
+	if (update == NULL) {
+		return;
+	}
+	free(update->added);
+	free(update->removed);
+	free(update);
+}
+
+
+/**
+ * Queue an update for the updater, taking ownership of it
+ */
+void update_push(struct update* update) {
+	pthread_mutex_lock(&queue_lock);
+	if (queue_tail != NULL) {
+		queue_tail->next = update;
+	} else {
+		queue_head = update;
+	}
+	queue_tail = update;
+	npending++;
+	pthread_cond_signal(&queue_ready);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+
+/**
+ * Apply queued updates one at a time until stopped
+ * Each update is ranked outside the snapshot lock, so queries carry on against the published
+ * snapshot and only wait while the new one is swapped in.
+ */
+static void* updater_run(void* arg) {
+	(void)arg;
+	while (1) {
+		pthread_mutex_lock(&queue_lock);
+		while (queue_head == NULL && !stopping) {
+			pthread_cond_wait(&queue_ready, &queue_lock);
+		}
+		struct update* update = queue_head;
+		if (update != NULL) {
+			queue_head = update->next;
+			queue_tail = queue_head != NULL ? queue_tail : NULL;
+		}
+		pthread_mutex_unlock(&queue_lock);
+		if (update == NULL) {
+			return NULL;
+		}
+
+		// Only this thread replaces the published snapshot, so it can be read without the lock
+		struct snapshot* old = current;
+		pagerank_graph* graph = old->graph;
+		if (update->nadded > 0 || update->nremoved > 0) {
+			graph = pagerank_graph_apply(old->graph, update->added, update->nadded, update->removed, update->nremoved);
+		}
+		double dampener = update->dampener > 0 ? update->dampener : old->dampener;
+		struct snapshot* next = graph != NULL ? snapshot_create(graph, dampener, old->generation + 1) : NULL;
+		if (next == NULL) {
+			fprintf(stderr, "update failed, keeping generation %ld\n", old->generation);
+			if (graph != old->graph) {
+				pagerank_graph_destroy(graph);
+			}
+		} else {
+			pthread_rwlock_wrlock(&snapshot_lock);
+			current = next;
+			pthread_rwlock_unlock(&snapshot_lock);
+			if (graph != old->graph) {
+				pagerank_graph_destroy(old->graph);
+			}
+			snapshot_destroy(old);
+		}
+
+		pthread_mutex_lock(&queue_lock);
+		npending--;
+		pthread_mutex_unlock(&queue_lock);
+		update_destroy(update);
+	}
+}
+
+
+/**
+ * Read the page pairs of an edges request, e.g. "add A B remove C D add E F"
+ * Names are resolved against the published graph, whose pages never change.
+ * @param words, the rest of the request
+ * @param update, filled with the edges
+ * @return 0 on success, otherwise -1 if a pair is invalid or an allocation fails
+ */
+static int parse_edges(char* words, struct update* update) {
+	int capacity = strlen(words) / 4 + 1;	// each pair takes at least "add a b "
+	update->added = malloc(sizeof(struct pagerank_edge) * capacity);
+	update->removed = malloc(sizeof(struct pagerank_edge) * capacity);
+	if (update->added == NULL || update->removed == NULL) {
+		return -1;
+	}
+
+	char* save;
+	char* word = strtok_r(words, " \t\r\n", &save);
+	if (word == NULL) {
+		return -1;
+	}
+	for (; word != NULL; word = strtok_r(NULL, " \t\r\n", &save)) {
+		char* source = strtok_r(NULL, " \t\r\n", &save);
+		char* target = strtok_r(NULL, " \t\r\n", &save);
+		if (source == NULL || target == NULL) {
+			return -1;
+		}
+		struct pagerank_edge edge = {
+			pagerank_graph_find(current->graph, source),
+			pagerank_graph_find(current->graph, target)
+		};
+		if (edge.source < 0 || edge.target < 0) {
+			return -1;
+		}
+		if (strcmp(word, "add") == 0) {
+			update->added[update->nadded++] = edge;
+		} else if (strcmp(word, "remove") == 0) {
+			update->removed[update->nremoved++] = edge;
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Answer one request line, writing any result lines then "ok" or "error <reason>"
+ * @param line, the request
+ * @param out, the connection to answer on
+ * @return 1 if the daemon should stop, otherwise 0
+ */
+static int handle_request(char* line, FILE* out) {
+	char* save;
+	char* command = strtok_r(line, " \t\r\n", &save);
+	char* rest = strtok_r(NULL, "\r\n", &save);
+	const char* error = NULL;
+
+	if (command == NULL) {
+		error = "empty request";
+	} else if (strcmp(command, "stop") == 0) {
+		fprintf(out, "ok\n");
+		return 1;
+	} else if (strcmp(command, "rank") == 0) {
+		struct update* update = calloc(1, sizeof(struct update));
+		if (update == NULL || rest == NULL || sscanf(rest, "%lf", &update->dampener) != 1
+				|| update->dampener <= 0 || update->dampener > 1) {
+			update_destroy(update);
+			error = "usage: rank dampener";
+		} else {
+			update_push(update);
+		}
+	} else if (strcmp(command, "edges") == 0) {
+		struct update* update = calloc(1, sizeof(struct update));
+		pthread_rwlock_rdlock(&snapshot_lock);
+		int failed = update == NULL || rest == NULL || current == NULL || parse_edges(rest, update) != 0;
+		pthread_rwlock_unlock(&snapshot_lock);
+		if (failed) {
+			update_destroy(update);
+			error = "usage: edges add|remove page page ...";
+		} else {
+			update_push(update);
+		}
+	} else if (strcmp(command, "top") == 0) {
+		int k = rest != NULL ? atoi(rest) : 0;
+		pthread_rwlock_rdlock(&snapshot_lock);
+		if (k <= 0 || current == NULL) {
+			error = "usage: top count";
+		} else {
+			int npages = pagerank_graph_npages(current->graph);
+			for (int i = 0; i < k && i < npages; i++) {
+				int page = current->order[i];
+				fprintf(out, "%s %.10g\n", pagerank_graph_name(current->graph, page), current->scores[page]);
+			}
+		}
+		pthread_rwlock_unlock(&snapshot_lock);
+	} else if (strcmp(command, "score") == 0) {
+		pthread_rwlock_rdlock(&snapshot_lock);
+		char* name = rest != NULL ? strtok_r(rest, " \t", &save) : NULL;
+		if (name == NULL || current == NULL) {
+			error = "usage: score page ...";
+		}
+		for (; name != NULL && error == NULL; name = strtok_r(NULL, " \t", &save)) {
+			int page = pagerank_graph_find(current->graph, name);
+			if (page < 0) {
+				error = "unknown page";
+			} else {
+				fprintf(out, "%s %.10g\n", name, current->scores[page]);
+			}
+		}
+		pthread_rwlock_unlock(&snapshot_lock);
+	} else if (strcmp(command, "status") == 0) {
+		pthread_mutex_lock(&queue_lock);
+		int pending = npending;
+		pthread_mutex_unlock(&queue_lock);
+		pthread_rwlock_rdlock(&snapshot_lock);
+		if (current != NULL) {
+			fprintf(out, "generation %ld dampener %lf pages %d edges %d pending %d\n", current->generation,
+					current->dampener, pagerank_graph_npages(current->graph), pagerank_graph_nedges(current->graph), pending);
+		}
+		pthread_rwlock_unlock(&snapshot_lock);
+	} else {
+		error = "unknown request";
+	}
+
+	if (error != NULL) {
+		fprintf(out, "error %s\n", error);
+	} else {
+		fprintf(out, "ok\n");
+	}
+	return 0;
+}
+
+
+/**
+ * Drop a connection from the open ones, waking the shutdown once the last has gone
+ */
+static void client_leave(struct client* client) {
+	pthread_mutex_lock(&clients_lock);
+	struct client** link = &clients;
+	while (*link != client) {
+		link = &(*link)->next;
+	}
+	*link = client->next;
+	if (--nclients == 0) {
+		pthread_cond_broadcast(&clients_done);
+	}
+	pthread_mutex_unlock(&clients_lock);
+	free(client);
+}
+
+
+/**
+ * Answer the requests of one connection, one per line, until it closes
+ */
+static void* client_run(void* arg) {
+	struct client* client = arg;
+	int fd = client->fd;
+	int copy = dup(fd);
+	FILE* in = fdopen(fd, "r");
+	FILE* out = copy >= 0 ? fdopen(copy, "w") : NULL;
+	if (in == NULL || out == NULL) {
+		if (in != NULL) {
+			fclose(in);
+		} else {
+			close(fd);
+		}
+		if (out != NULL) {
+			fclose(out);
+		} else if (copy >= 0) {
+			close(copy);
+		}
+		client_leave(client);
+		return NULL;
+	}
+
+	char line[REQUEST_SIZE];
+	while (fgets(line, sizeof(line), in) != NULL) {
+		int stop = handle_request(line, out);
+		fflush(out);
+		if (stop) {
+			pthread_mutex_lock(&queue_lock);
+			stopping = 1;
+			pthread_cond_signal(&queue_ready);
+			pthread_mutex_unlock(&queue_lock);
+			shutdown(listener, SHUT_RDWR);
+			break;
+		}
+	}
+	client_leave(client);
+	fclose(in);
+	fclose(out);
+	return NULL;
+}
+
+
+int main(int argc, char** argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		if (opt != 'k') {
+			argc = 0;
+			break;
+		}
+		kernel = optarg;
+	}
+	if (argc - optind != 2) {
+		fprintf(stderr, "usage: %s [-k kernel] socket input\n", argv[0]);
+		return 1;
+	}
+	const char* path = argv[optind];
+
+	// Load and rank the graph before accepting connections
+	pagerank_graph* graph = pagerank_graph_load_file(argv[optind + 1]);
+	if (graph == NULL) {
+		fprintf(stderr, "%s: invalid input\n", argv[optind + 1]);
+		return 1;
+	}
+	if ((current = snapshot_create(graph, pagerank_graph_dampener(graph), 0)) == NULL) {
+		fprintf(stderr, "%s: invalid kernel\n", kernel);
+		pagerank_graph_destroy(graph);
+		return 1;
+	}
+
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+	unlink(path);
+	if ((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0
+			|| listen(listener, SOMAXCONN) != 0) {
+		perror(path);
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	pthread_t updater;
+	if (pthread_create(&updater, NULL, updater_run, NULL) != 0) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	// One thread per connection until a stop request shuts the listener down
+	while (1) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			pthread_mutex_lock(&queue_lock);
+			int stop = stopping;
+			pthread_mutex_unlock(&queue_lock);
+			if (stop || (errno != EINTR && errno != ECONNABORTED)) {
+				break;
+			}
+			continue;
+		}
+		struct client* client = malloc(sizeof(struct client));
+		if (client == NULL) {
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		pthread_mutex_lock(&clients_lock);
+		client->next = clients;
+		clients = client;
+		nclients++;
+		pthread_mutex_unlock(&clients_lock);
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, client_run, client) != 0) {
+			client_leave(client);
+			close(fd);
+			continue;
+		}
+		pthread_detach(thread);
+	}
+
+	// Connections still open stop reading, and are waited out as they may be reading the snapshot
+	pthread_mutex_lock(&clients_lock);
+	for (struct client* client = clients; client != NULL; client = client->next) {
+		shutdown(client->fd, SHUT_RD);
+	}
+	while (nclients > 0) {
+		pthread_cond_wait(&clients_done, &clients_lock);
+	}
+	pthread_mutex_unlock(&clients_lock);
+
+	// Queued updates are dropped
+	pthread_mutex_lock(&queue_lock);
+	stopping = 1;
+	while (queue_head != NULL) {
+		struct update* update = queue_head;
+		queue_head = update->next;
+		update_destroy(update);
+	}
+	queue_tail = NULL;
+	pthread_cond_signal(&queue_ready);
+	pthread_mutex_unlock(&queue_lock);
+	pthread_join(updater, NULL);
+
+	close(listener);
+	unlink(path);
+	pagerank_graph_destroy(current->graph);
+	snapshot_destroy(current);
+	current = NULL;
+	return 0;
+}
@@ -24,6 +24,16 @@ while true; do
 	esac
 done
 
+bench_ans=0
+while true; do
+	read -p "Do you wish to run large graph benchmarks? " ans
+	case $ans in
+		[Yy]* ) let bench_ans=1; break;;
+		[Nn]* ) break;;
+		* ) echo "Please answer y/N.";;
+	esac
+done
+
 valid_ans=0
 while true; do
 	read -p "Do you wish to run validity tests? " ans
@@ -76,6 +86,53 @@ then
 fi
 
 
+################################################
+############# LARGE GRAPH BENCHMARK ############
+################################################
+if [ $bench_ans -eq 1 ]
+then
+	echo "-------------------- LARGE GRAPH BENCHMARKS --------"
+	# Generated graphs with 8 edges per page, the last scores vector exceeds most LLCs
+	for size in 250000,2000000 1250000,10000000 4000000,32000000
+	do
+		for kernel in csr blocked
+		do
+			echo -e "$size\t$kernel\t$(./pagerank -k $kernel -g $size | tail -n 1)"
+		done
+	done
+
+	# Reordering cost (stderr) against the total time including it
+	for order in degree rcm gorder
+	do
+		echo -e "1250000,10000000\t$order\t$(./pagerank -k csr -r $order -g 1250000,10000000 2>&1 | tail -n 1)"
+	done
+
+	# Extrapolation and krylov solvers on the slowest converging tests, iterations or matrix
+	# multiplications (stderr) next to the time
+	for f in test/tests/test10.in test/tests/test11.in test/tests/test12.in
+	do
+		for kernel in csr aitken quadratic bicgstab gmres scc
+		do
+			echo -e "$f\t$kernel\t$(./pagerank -l -k $kernel < $f 2>&1 >/dev/null)\t$(./pagerank -l -k $kernel < $f 2>/dev/null | tail -n 1)"
+		done
+	done
+
+	# Monte Carlo largest error against the exact scores next to the time, for more walks per
+	# page. test12 is left out as its walks average 50000 steps at a dampening effect of 0.99998
+	for f in test/tests/test0*.in test/tests/test1[01].in
+	do
+		let len=${#f}-2
+		fname=${f:0:len}out
+		for walks in 16 256 4096
+		do
+			./pagerank -l -k montecarlo -w $walks < $f 2>/dev/null > mc.txt
+			echo -e "$f\t$walks\t$(head -n -1 mc.txt | paste -d ' ' - $fname | awk '{ e = $2 - $4; e = e < 0 ? -e : e; m = e > m ? e : m } END { printf "%.4f", m }')\t$(tail -n 1 mc.txt)"
+		done
+	done
+	rm -f mc.txt
+fi
+
+
 ################################################
 ############### VALIDITY TESTS #################
 ################################################
@@ -99,6 +156,118 @@ then
 		echo "Test $fname"
 		./pagerank < $f | diff - $fname
 	done
+
+	# The last line of output is the time taken
+	echo "Testing Single and Mixed Precision."
+	for kernel in float mixed
+	do
+		for f in test/tests/*.in
+		do
+			let len=${#f}-2
+			fname=${f:0:len}out
+			echo "Test $kernel $fname"
+			./pagerank -k $kernel < $f | head -n -1 | diff - $fname
+		done
+	done
+
+	echo "Testing CSR, Push and Out of Core Kernels."
+	for args in "-k csr" "-k push" "-k adaptive" "-k blocked" "-k edge" "-k compressed" "-k scc" \
+		"-k weighted" "-k sharded" "-k external -e /tmp" "-k balanced" "-k balanced_split" "-k steal"
+	do
+		for f in test/tests/*.in
+		do
+			let len=${#f}-2
+			fname=${f:0:len}out
+			echo "Test $args $fname"
+			./pagerank $args < $f 2>/dev/null | head -n -1 | diff - $fname
+		done
+	done
+
+	echo "Testing Kernel Options."
+	for args in "-k csr -D" "-k weighted -D" "-k csr -l" "-k csr -l -n" \
+		"-k csr -P" "-k csr -P -n"
+	do
+		for f in test/tests/*.in
+		do
+			let len=${#f}-2
+			fname=${f:0:len}out
+			echo "Test $args $fname"
+			./pagerank $args < $f 2>/dev/null | head -n -1 | diff - $fname
+		done
+	done
+
+	# Each column of a batch ranking against a single ranking with that dampener as the input's
+	echo "Testing Batched Dampeners."
+	for f in test/tests/*.in
+	do
+		./pagerank -d 0.85,0.5 < $f 2>/dev/null | head -n -1 > batch.txt
+		for column in 1 2
+		do
+			dampener=$(echo 0.85,0.5 | cut -d , -f $column)
+			echo "Test -d $dampener $f"
+			sed "2s/.*/$dampener/" $f | ./pagerank -k csr 2>/dev/null | head -n -1 \
+				| diff - <(awk -v column=$column '{ print $1, $(column + 1) }' batch.txt)
+		done
+	done
+	rm -f batch.txt
+
+	echo "Testing Reordered Kernels."
+	for kernel in csr blocked push adaptive
+	do
+		for order in degree rcm gorder
+		do
+			for f in test/tests/*.in
+			do
+				let len=${#f}-2
+				fname=${f:0:len}out
+				echo "Test $kernel -r $order $fname"
+				./pagerank -k $kernel -r $order < $f 2>/dev/null | head -n -1 | diff - $fname
+			done
+		done
+	done
+
+	# A host program with functions named like the library's internal ones must still link
+	echo "Testing Library Embedding."
+	make test_embed && ./test_embed
+
+	# Each request is one line on its own connection, answered by result lines then ok or error
+	echo "Testing Daemon."
+	make pagerankd
+	socket=/tmp/pagerankd.$$.sock
+	request() {
+		python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall((sys.argv[2] + "\n").encode())
+for line in s.makefile():
+	print(line, end="")
+	if line.startswith("ok") or line.startswith("error"):
+		break
+' $socket "$1"
+	}
+	# Updates are applied in the background, so wait for the queue to empty before checking them
+	settled() {
+		until [[ $(request status) == *"pending 0"* ]] || ! kill -0 $daemon; do sleep 0.1; done
+		request status | sed -n 1p | cut -d ' ' -f 1-8
+	}
+	./pagerankd $socket test/tests/sample.in 2> pagerankd.log &
+	daemon=$!
+	until [ -S $socket ] || ! kill -0 $daemon; do sleep 0.1; done
+	request status | diff - <(echo -e "generation 0 dampener 0.850000 pages 4 edges 5 pending 0\nok")
+	request "top 2" | diff - <(echo -e "A 0.068578125\nC 0.068578125\nok")
+	request "score B D" | awk '{ printf "%s %.4f\n", $1, $2 }' | sed -n 1,2p | diff - <(sed -n '2p;4p' test/tests/sample.out)
+	request "score Z" | diff - <(echo "error unknown page")
+	request "rank 0.5" > /dev/null
+	settled | diff - <(echo "generation 1 dampener 0.500000 pages 4 edges 5")
+	request "edges add A B" > /dev/null
+	settled | diff - <(echo "generation 2 dampener 0.500000 pages 4 edges 6")
+	request "edges remove A D" > /dev/null
+	settled | diff - <(echo "generation 2 dampener 0.500000 pages 4 edges 6")
+	grep -q "update failed, keeping generation 2" pagerankd.log || echo "missing update failure"
+	request stop | diff - <(echo "ok")
+	wait $daemon
+	rm -f pagerankd.log
 fi
 
 ################################################
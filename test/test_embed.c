@@ -0,0 +1,47 @@
+/*
+ * Link test for libpagerank.a
+ *
+ * The host defines functions with the same names as functions inside the library, which must
+ * not clash with them, then ranks a graph through the library interface.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/libpagerank.h"
+
+int multiply(int a, int b) {
+	return a * b;
+}
+
+void clean_up(void* data) {
+	(void)data;
+}
+
+void update_score(void) {
+}
+
+int parse_options(void) {
+	return 0;
+}
+
+int pagerank(void) {
+	return 0;
+}
+
+int pagerank_main(void) {
+	return 0;
+}
+
+int main(void) {
+	const char* input = "1\n0.85\n2\nA\nB\n2\nA B\nB A\n";
+	pagerank_graph* graph = pagerank_graph_load_buffer(input, strlen(input));
+	struct pagerank_run_options options = { "csr", 1, 0 };
+	int failed = graph == NULL || pagerank_graph_rank(graph, &options) != 0
+		|| fabs(pagerank_graph_scores(graph)[0] - 0.5) > 1E-3 || fabs(pagerank_graph_scores(graph)[1] - 0.5) > 1E-3
+		|| multiply(2, 3) != 6;
+	pagerank_graph_destroy(graph);
+	printf(failed ? "embedding failed\n" : "embedding ok\n");
+	return failed ? 1 : 0;
+}